@@ -19,7 +19,217 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
  ***************************************************************************/
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "chronos.h"
+#include "chronos_backend.h"
+
+static long kernel_do_rt_seg(int op, struct rt_data *data) {
+	return syscall(__NR_do_rt_seg, op, data);
+}
+
+/* The tid of the calling thread is cached so the mutex fast paths don't need a
+ * system call. Forked children start with their parent's cache, so it's
+ * cleared in them. */
+static __thread int cached_tid = 0;
+static pthread_once_t tid_once = PTHREAD_ONCE_INIT;
+
+static void clear_cached_tid(void) {
+	cached_tid = 0;
+}
+
+static void register_tid_atfork(void) {
+	pthread_atfork(NULL, NULL, clear_cached_tid);
+}
+
+int chronos_self_tid(void) {
+	if(!cached_tid) {
+		pthread_once(&tid_once, register_tid_atfork);
+		cached_tid = syscall(SYS_gettid);
+	}
+	return cached_tid;
+}
+
+static int mutex_fastpath = -1;
+
+int chronos_mutex_fastpath(int enable) {
+	if(enable >= 0)
+		mutex_fastpath = enable ? 1 : 0;
+	else if(mutex_fastpath < 0)
+		mutex_fastpath = getenv("CHRONOS_MUTEX_FASTPATH") ?
+			atoi(getenv("CHRONOS_MUTEX_FASTPATH")) != 0 : 0;
+	return mutex_fastpath;
+}
+
+/* Take or release an uncontended lock without entering the kernel. The word
+ * protocol is described with CHRONOS_MUTEX_WAITERS in chronos.h. */
+static long kernel_do_chronos_mutex(chronos_mutex_t *m, int op) {
+	int tid;
+
+	if(chronos_mutex_fastpath(-1)) {
+		switch(op) {
+		case CHRONOS_MUTEX_REQUEST:
+			tid = chronos_self_tid();
+			if(__sync_bool_compare_and_swap(&m->value, 0, tid)) {
+				m->owner = tid;
+				return 0;
+			}
+			break;
+		case CHRONOS_MUTEX_RELEASE:
+			tid = chronos_self_tid();
+			if(m->value != (u_int32_t)tid)
+				break;
+			m->owner = 0;
+			if(__sync_bool_compare_and_swap(&m->value, tid, 0))
+				return 0;
+			m->owner = tid;
+			break;
+		}
+	}
+
+	return syscall(__NR_do_chronos_mutex, m, op);
+}
+
+static long kernel_set_scheduler(int scheduler, int prio, unsigned long cpus) {
+	unsigned long mask = cpus;
+	unsigned int len = sizeof(mask);
+
+	return syscall(__NR_set_scheduler, scheduler, prio, len, (cpu_set_t*) &mask);
+}
+
+/* The ChronOS system calls. Everything else is left to the defaults. */
+struct chronos_backend chronos_kernel_backend = {
+	"kernel",
+	NULL,
+	kernel_do_rt_seg,
+	kernel_do_chronos_mutex,
+	NULL,
+	kernel_set_scheduler,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	0,
+	CLOCK_REALTIME
+};
+
+/* Indexed by the CHRONOS_BACKEND_* constants */
+static struct chronos_backend *backends[CHRONOS_NUM_BACKENDS] = {
+	&chronos_kernel_backend,
+	&chronos_sim_backend,
+	&chronos_user_backend,
+	&chronos_deadline_backend
+};
+
+static struct chronos_backend *backend = NULL;
+static int backend_num = -1;
+
+/* Find a backend's number given its name. Returns -1 if there is none. */
+int chronos_find_backend(const char *name) {
+	int i;
+
+	for(i = 0; i < CHRONOS_NUM_BACKENDS; i++) {
+		if(!strcmp(name, backends[i]->name))
+			return i;
+	}
+	return -1;
+}
+
+const char *chronos_backend_name(int backend) {
+	if(backend < 0 || backend >= CHRONOS_NUM_BACKENDS)
+		return NULL;
+	return backends[backend]->name;
+}
+
+/* Select and initialize a backend. Returns 0 on success, -1 on failure. */
+int chronos_set_backend(int num) {
+	if(num < 0 || num >= CHRONOS_NUM_BACKENDS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(backends[num]->init && backends[num]->init())
+		return -1;
+
+	backend = backends[num];
+	backend_num = num;
+	return 0;
+}
+
+int chronos_get_backend(void) {
+	chronos_backend_ops();
+	return backend_num;
+}
+
+/* Return the current backend, choosing one from the CHRONOS_BACKEND
+ * environment variable (or the kernel) if none was explicitly selected */
+struct chronos_backend *chronos_backend_ops(void) {
+	const char *env;
+	int num;
+
+	if(backend)
+		return backend;
+
+	env = getenv("CHRONOS_BACKEND");
+	num = env ? chronos_find_backend(env) : CHRONOS_BACKEND_KERNEL;
+	if(num < 0 || chronos_set_backend(num))
+		chronos_set_backend(CHRONOS_BACKEND_KERNEL);
+
+	return backend;
+}
+
+void chronos_job_begin(struct chronos_job *job, struct rt_data *data,
+		       unsigned long seq) {
+	job->in_rtseg = 1;
+	job->prio = data->prio;
+	job->max_util = data->max_util;
+	job->exec_ns = (long long)data->exec_time * 1000;
+	job->deadline_ns = data->deadline ? timespec_to_ns(data->deadline) : LLONG_MAX;
+	job->period_ns = data->period ? timespec_to_ns(data->period) : LLONG_MAX;
+	job->seq = seq;
+}
+
+long long chronos_job_key(int scheduler, struct chronos_job *job) {
+	if(!job->in_rtseg)
+		return CHRONOS_KEY_IDLE;
+
+	switch(scheduler & ~SCHED_FLAGS_MASK) {
+	case SCHED_RT_RMA:
+	case SCHED_RT_RMA_ICPP:
+	case SCHED_RT_RMA_OCPP:
+	case SCHED_RT_GRMA:
+		return job->period_ns;
+	case SCHED_RT_EDF:
+		return job->deadline_ns;
+	case SCHED_RT_HVDF:
+		/* highest value density (utility per second of execution) first */
+		if(job->exec_ns <= 0)
+			return LLONG_MIN;
+		return -(long long)((double)job->max_util * 1e12 / job->exec_ns);
+	default:
+		/* FIFO within priority */
+		return ((long long)(100 - job->prio) << 40) + job->seq;
+	}
+}
+
+static long do_rt_seg(int op, struct rt_data *data) {
+	struct chronos_backend *b = chronos_backend_ops();
+
+	if(b->do_rt_seg)
+		return b->do_rt_seg(op, data);
+	return kernel_do_rt_seg(op, data);
+}
+
+static long do_chronos_mutex(chronos_mutex_t *m, int op) {
+	struct chronos_backend *b = chronos_backend_ops();
+
+	if(b->do_chronos_mutex)
+		return b->do_chronos_mutex(m, op);
+	return kernel_do_chronos_mutex(m, op);
+}
 
 /* Set the basic information of the calling task */
 long begin_rtseg_selfbasic(int prio, struct timespec* deadline,
@@ -31,7 +241,7 @@ long begin_rtseg_selfbasic(int prio, struct timespec* deadline,
 	data.exec_time = 0;
 	data.period = period;
 	data.deadline = deadline;
-	return syscall(__NR_do_rt_seg, RT_SEG_BEGIN, &data);
+	return do_rt_seg(RT_SEG_BEGIN, &data);
 }
 
 /* Set the basic information of another task */
@@ -44,7 +254,7 @@ long begin_rtseg_basic(int tid, int prio, struct timespec* deadline,
 	data.exec_time = 0;
 	data.period = period;
 	data.deadline = deadline;
-	return syscall(__NR_do_rt_seg, RT_SEG_BEGIN, &data);
+	return do_rt_seg(RT_SEG_BEGIN, &data);
 }
 
 /* Set the full rt information of the calling task */
@@ -57,7 +267,7 @@ long begin_rtseg_self(int prio, int max_util, struct timespec* deadline,
 	data.exec_time = exec_time;
 	data.period = period;
 	data.deadline = deadline;
-	return syscall(__NR_do_rt_seg, RT_SEG_BEGIN, &data);
+	return do_rt_seg(RT_SEG_BEGIN, &data);
 }
 
 /* Set the full rt information of another task */
@@ -70,7 +280,7 @@ long begin_rtseg(int tid, int prio, int max_util, struct timespec* deadline,
 	data.exec_time = exec_time;
 	data.period = period;
 	data.deadline = deadline;
-	return syscall(__NR_do_rt_seg, RT_SEG_BEGIN, &data);
+	return do_rt_seg(RT_SEG_BEGIN, &data);
 }
 
 /* End the real-time portion of the calling task */
@@ -80,7 +290,7 @@ long end_rtseg_self(int prio) {
 	data.prio = prio;
 	data.period = NULL;
 	data.deadline = NULL;
-	return syscall(__NR_do_rt_seg, RT_SEG_END, &data);
+	return do_rt_seg(RT_SEG_END, &data);
 }
 
 /* End the real-time portion of another task */
@@ -90,7 +300,48 @@ long end_rtseg(int tid, int prio) {
 	data.prio = prio;
 	data.period = NULL;
 	data.deadline = NULL;
-	return syscall(__NR_do_rt_seg, RT_SEG_END, &data);
+	return do_rt_seg(RT_SEG_END, &data);
+}
+
+/* The backend last found to have no RT_SEG_NEXT_JOB */
+static struct chronos_backend *no_next_job = NULL;
+
+/* End the current job of the calling task and begin the next one */
+long next_rtseg_self(int end_prio, int prio, int max_util,
+		     struct timespec* release, struct timespec* deadline,
+		     struct timespec* period, unsigned long exec_time) {
+	struct chronos_backend *b = chronos_backend_ops();
+	struct rt_data data;
+	long ret;
+
+	if(b != no_next_job) {
+		data.tid = 0;
+		data.prio = prio;
+		data.max_util = max_util;
+		data.exec_time = exec_time;
+		data.period = period;
+		data.deadline = deadline;
+		data.release = release;
+		ret = do_rt_seg(RT_SEG_NEXT_JOB, &data);
+		if(!ret)
+			return 0;
+
+		/* The userspace backends all implement it, so an EINVAL from
+		 * them is the caller's; a ChronOS kernel which predates it
+		 * refuses it with EINVAL like any op it doesn't know */
+		if(errno != ENOSYS &&
+		   (errno != EINVAL || b != &chronos_kernel_backend))
+			return ret;
+		no_next_job = b;
+	}
+
+	if(end_rtseg_self(end_prio))
+		return -1;
+	if(release &&
+	   chronos_clock_nanosleep(chronos_deadline_clock(), TIMER_ABSTIME,
+				   release))
+		return -1;
+	return begin_rtseg_self(prio, max_util, deadline, period, exec_time);
 }
 
 /* Add an abort handler for the task */
@@ -102,7 +353,7 @@ long add_abort_handler_self(int max_util, struct timespec *deadline,
 	data.exec_time = exec_time;
 	data.period = NULL;
 	data.deadline = deadline;
-	return syscall(__NR_do_rt_seg, RT_SEG_ADD_ABORT, &data);
+	return do_rt_seg(RT_SEG_ADD_ABORT, &data);
 }
 
 /* Add an abort handler for another task */
@@ -114,7 +365,7 @@ long add_abort_handler(int tid, int max_util, struct timespec *deadline,
 	data.exec_time = exec_time;
 	data.period = NULL;
 	data.deadline = deadline;
-	return syscall(__NR_do_rt_seg, RT_SEG_ADD_ABORT, &data);
+	return do_rt_seg(RT_SEG_ADD_ABORT, &data);
 }
 
 /* Add an abort handler for the task with no deadline */
@@ -125,7 +376,7 @@ long add_abort_handler_selfnodeadline(int max_util, unsigned long exec_time) {
 	data.exec_time = exec_time;
 	data.period = NULL;
 	data.deadline = NULL;
-	return syscall(__NR_do_rt_seg, RT_SEG_ADD_ABORT, &data);
+	return do_rt_seg(RT_SEG_ADD_ABORT, &data);
 }
 
 /* Add an abort handler for another task with no deadline */
@@ -137,14 +388,15 @@ long add_abort_handler_nodeadline(int tid, int max_util,
 	data.exec_time = exec_time;
 	data.period = NULL;
 	data.deadline = NULL;
-	return syscall(__NR_do_rt_seg, RT_SEG_ADD_ABORT, &data);
+	return do_rt_seg(RT_SEG_ADD_ABORT, &data);
 }
 
 long set_scheduler(int scheduler, int prio, unsigned long cpus) {
-	unsigned long mask = cpus;
-	unsigned int len = sizeof(mask);
+	struct chronos_backend *b = chronos_backend_ops();
 
-	return syscall(__NR_set_scheduler, scheduler, prio, len, (cpu_set_t*) &mask);
+	if(b->set_scheduler)
+		return b->set_scheduler(scheduler, prio, cpus);
+	return kernel_set_scheduler(scheduler, prio, cpus);
 }
 
 /* Changed from class for ease in replacing pthread_mutext */
@@ -152,25 +404,277 @@ long set_scheduler(int scheduler, int prio, unsigned long cpus) {
 long chronos_mutex_init(chronos_mutex_t *m) {
 	m->value = 0;
 	m->owner = 0;
-	return syscall(__NR_do_chronos_mutex, m, CHRONOS_MUTEX_INIT);
+	return do_chronos_mutex(m, CHRONOS_MUTEX_INIT);
 }
 
 /* Destroy a resource */
 long chronos_mutex_destroy(chronos_mutex_t *m) {
-	return syscall(__NR_do_chronos_mutex, m, CHRONOS_MUTEX_DESTROY);
+	return do_chronos_mutex(m, CHRONOS_MUTEX_DESTROY);
 }
 
 /* Request a resource from the host */
 long chronos_mutex_lock(chronos_mutex_t *m) {
-	return syscall(__NR_do_chronos_mutex, m, CHRONOS_MUTEX_REQUEST);
+	return do_chronos_mutex(m, CHRONOS_MUTEX_REQUEST);
 }
 
 /* Release a resource */
 long chronos_mutex_unlock(chronos_mutex_t *m) {
-	return syscall(__NR_do_chronos_mutex, m, CHRONOS_MUTEX_RELEASE);
+	return do_chronos_mutex(m, CHRONOS_MUTEX_RELEASE);
 }
 
 int chronos_mutex_owner(chronos_mutex_t *m) {
 	return m->owner;
 }
 
+/* Copy a lock set into sorted in canonical (address) order, dropping any
+ * duplicates. Returns the number of distinct locks, or -1 if n is invalid. */
+static int sort_lock_set(chronos_mutex_t **locks, int n,
+			 chronos_mutex_t **sorted) {
+	int i, j, count = 0;
+
+	if(n < 0 || n > CHRONOS_MAX_LOCK_SET) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for(i = 0; i < n; i++) {
+		for(j = count; j > 0 && sorted[j - 1] > locks[i]; j--)
+			;
+		if(j > 0 && sorted[j - 1] == locks[i])
+			continue;
+		memmove(&sorted[j + 1], &sorted[j],
+			(count - j) * sizeof(chronos_mutex_t *));
+		sorted[j] = locks[i];
+		count++;
+	}
+	return count;
+}
+
+long chronos_mutex_lock_set(chronos_mutex_t **locks, int n) {
+	struct chronos_backend *b = chronos_backend_ops();
+	chronos_mutex_t *sorted[CHRONOS_MAX_LOCK_SET];
+	int i, err, count = sort_lock_set(locks, n, sorted);
+
+	if(count < 0)
+		return -1;
+	if(b->do_chronos_mutex_set)
+		return b->do_chronos_mutex_set(sorted, count,
+					       CHRONOS_MUTEX_REQUEST);
+
+	for(i = 0; i < count; i++) {
+		if(chronos_mutex_lock(sorted[i])) {
+			/* Give back what we have so far */
+			err = errno;
+			while(--i >= 0)
+				chronos_mutex_unlock(sorted[i]);
+			errno = err;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+long chronos_mutex_unlock_set(chronos_mutex_t **locks, int n) {
+	struct chronos_backend *b = chronos_backend_ops();
+	chronos_mutex_t *sorted[CHRONOS_MAX_LOCK_SET];
+	int i, count = sort_lock_set(locks, n, sorted);
+	long ret = 0;
+
+	if(count < 0)
+		return -1;
+	if(b->do_chronos_mutex_set)
+		return b->do_chronos_mutex_set(sorted, count,
+					       CHRONOS_MUTEX_RELEASE);
+
+	for(i = count - 1; i >= 0; i--) {
+		if(chronos_mutex_unlock(sorted[i]))
+			ret = -1;
+	}
+	return ret;
+}
+
+static void rwlock_slots(chronos_rwlock_t *rw, chronos_mutex_t **slots) {
+	int i;
+
+	for(i = 0; i < CHRONOS_RWLOCK_SLOTS; i++)
+		slots[i] = &rw->slots[i];
+}
+
+long chronos_rwlock_init(chronos_rwlock_t *rw) {
+	int i;
+
+	rw->writer = 0;
+	for(i = 0; i < CHRONOS_RWLOCK_SLOTS; i++) {
+		if(chronos_mutex_init(&rw->slots[i]))
+			return -1;
+	}
+	return 0;
+}
+
+long chronos_rwlock_destroy(chronos_rwlock_t *rw) {
+	long ret = 0;
+	int i;
+
+	for(i = 0; i < CHRONOS_RWLOCK_SLOTS; i++) {
+		if(chronos_mutex_destroy(&rw->slots[i]))
+			ret = -1;
+	}
+	return ret;
+}
+
+long chronos_rwlock_rdlock(chronos_rwlock_t *rw) {
+	return chronos_mutex_lock(&rw->slots[chronos_self_tid() %
+					     CHRONOS_RWLOCK_SLOTS]);
+}
+
+long chronos_rwlock_wrlock(chronos_rwlock_t *rw) {
+	chronos_mutex_t *slots[CHRONOS_RWLOCK_SLOTS];
+
+	rwlock_slots(rw, slots);
+	if(chronos_mutex_lock_set(slots, CHRONOS_RWLOCK_SLOTS))
+		return -1;
+	rw->writer = chronos_self_tid();
+	return 0;
+}
+
+long chronos_rwlock_unlock(chronos_rwlock_t *rw) {
+	chronos_mutex_t *slots[CHRONOS_RWLOCK_SLOTS];
+	int tid = chronos_self_tid();
+
+	/* A reader only holds its own slot */
+	if(rw->writer != tid)
+		return chronos_mutex_unlock(&rw->slots[tid % CHRONOS_RWLOCK_SLOTS]);
+
+	rw->writer = 0;
+	rwlock_slots(rw, slots);
+	return chronos_mutex_unlock_set(slots, CHRONOS_RWLOCK_SLOTS);
+}
+
+/* Copy a set of reader/writer locks into sorted in canonical (address) order,
+ * dropping duplicates, and their modes into sorted_write. Returns the number of
+ * distinct locks, or -1 if n is invalid. */
+static int sort_rwlock_set(chronos_rwlock_t **locks, const int *write, int n,
+			   chronos_rwlock_t **sorted, int *sorted_write) {
+	int i, j, w, count = 0;
+
+	if(n < 0 || n > CHRONOS_MAX_LOCK_SET) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for(i = 0; i < n; i++) {
+		w = !write || write[i];
+		for(j = count; j > 0 && sorted[j - 1] > locks[i]; j--)
+			;
+		if(j > 0 && sorted[j - 1] == locks[i]) {
+			sorted_write[j - 1] |= w;
+			continue;
+		}
+		memmove(&sorted[j + 1], &sorted[j],
+			(count - j) * sizeof(chronos_rwlock_t *));
+		memmove(&sorted_write[j + 1], &sorted_write[j],
+			(count - j) * sizeof(int));
+		sorted[j] = locks[i];
+		sorted_write[j] = w;
+		count++;
+	}
+	return count;
+}
+
+long chronos_rwlock_lock_set(chronos_rwlock_t **locks, const int *write, int n) {
+	chronos_rwlock_t *sorted[CHRONOS_MAX_LOCK_SET];
+	int sorted_write[CHRONOS_MAX_LOCK_SET];
+	int i, err, count = sort_rwlock_set(locks, write, n, sorted, sorted_write);
+	long ret;
+
+	if(count < 0)
+		return -1;
+
+	for(i = 0; i < count; i++) {
+		if(sorted_write[i])
+			ret = chronos_rwlock_wrlock(sorted[i]);
+		else
+			ret = chronos_rwlock_rdlock(sorted[i]);
+		if(ret) {
+			/* Give back what we have so far */
+			err = errno;
+			while(--i >= 0)
+				chronos_rwlock_unlock(sorted[i]);
+			errno = err;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+long chronos_rwlock_unlock_set(chronos_rwlock_t **locks, int n) {
+	chronos_rwlock_t *sorted[CHRONOS_MAX_LOCK_SET];
+	int sorted_write[CHRONOS_MAX_LOCK_SET];
+	int i, count = sort_rwlock_set(locks, NULL, n, sorted, sorted_write);
+	long ret = 0;
+
+	if(count < 0)
+		return -1;
+
+	for(i = count - 1; i >= 0; i--) {
+		if(chronos_rwlock_unlock(sorted[i]))
+			ret = -1;
+	}
+	return ret;
+}
+
+long chronos_task_register(void) {
+	struct chronos_backend *b = chronos_backend_ops();
+
+	if(b->task_register)
+		return b->task_register();
+	return 0;
+}
+
+long chronos_task_unregister(void) {
+	struct chronos_backend *b = chronos_backend_ops();
+
+	if(b->task_unregister)
+		return b->task_unregister();
+	return 0;
+}
+
+clockid_t chronos_deadline_clock(void) {
+	return chronos_backend_ops()->deadline_clock;
+}
+
+int chronos_clock_gettime(clockid_t clk, struct timespec *ts) {
+	struct chronos_backend *b = chronos_backend_ops();
+
+	if(b->clock_gettime)
+		return b->clock_gettime(clk, ts);
+	return clock_gettime(clk, ts);
+}
+
+int chronos_real_nanosleep(clockid_t clk, int flags,
+			   const struct timespec *req) {
+	struct timespec left = *req;
+	int ret;
+
+	while((ret = clock_nanosleep(clk, flags, &left, &left)) == EINTR) {
+		if(flags & TIMER_ABSTIME)
+			left = *req;
+	}
+
+	if(ret) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
+
+/* Like clock_nanosleep(), but returns -1 and sets errno on failure, and
+ * restarts the sleep if it is interrupted by a signal */
+int chronos_clock_nanosleep(clockid_t clk, int flags,
+			    const struct timespec *req) {
+	struct chronos_backend *b = chronos_backend_ops();
+
+	if(b->clock_nanosleep)
+		return b->clock_nanosleep(clk, flags, req);
+	return chronos_real_nanosleep(clk, flags, req);
+}
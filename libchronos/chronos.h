@@ -85,12 +85,33 @@
 #define RT_SEG_BEGIN			0
 #define RT_SEG_END			1
 #define RT_SEG_ADD_ABORT		2
+#define RT_SEG_NEXT_JOB			3
 
 #define CHRONOS_MUTEX_REQUEST		0
 #define CHRONOS_MUTEX_RELEASE		1
 #define CHRONOS_MUTEX_INIT		2
 #define CHRONOS_MUTEX_DESTROY		3
 
+/* The most locks chronos_mutex_lock_set() takes at once */
+#define CHRONOS_MAX_LOCK_SET		64
+
+/* Backends which libchronos can route the calls below to. The backend is
+ * chosen with chronos_set_backend() or, failing that, from the CHRONOS_BACKEND
+ * environment variable the first time the library is used.
+ * KERNEL - the ChronOS system calls (the default)
+ * SIM - an in-process discrete-event simulation running in virtual time
+ * USER - a userspace dispatcher mapping jobs onto SCHED_FIFO priorities. Only
+ *	the best jobs of a domain, one for each priority between the highest
+ *	task priority and 1, are told apart; the others all wait at priority 1
+ *	in FIFO order until one of them ranks among the best
+ * DEADLINE - EDF jobs run under the mainline SCHED_DEADLINE class
+ */
+#define CHRONOS_BACKEND_KERNEL		0
+#define CHRONOS_BACKEND_SIM		1
+#define CHRONOS_BACKEND_USER		2
+#define CHRONOS_BACKEND_DEADLINE	3
+#define CHRONOS_NUM_BACKENDS		4
+
 struct rt_data {
 	int tid;
 	int prio;
@@ -98,6 +119,7 @@ struct rt_data {
 	unsigned int max_util;
 	struct timespec *deadline;
 	struct timespec *period;
+	struct timespec *release;	/* RT_SEG_NEXT_JOB only */
 };
 
 /* An actual mutex */
@@ -109,6 +131,42 @@ struct mutex_data {
 
 typedef struct mutex_data chronos_mutex_t;
 
+/* With the mutex fast path enabled, the kernel backend takes and releases
+ * uncontended locks in userspace. value is then 0 while the lock is free and
+ * the owner's tid while it's held; a task that finds it held enters the kernel,
+ * which must take the owner from value and set CHRONOS_MUTEX_WAITERS so the
+ * owner enters the kernel to release it too. */
+#define CHRONOS_MUTEX_WAITERS		0x80000000
+
+/* A reader/writer lock. Each reader takes one of the slot mutexes, picked by
+ * its tid, while a writer takes all of them as one lock set. Readers in
+ * different slots don't exclude each other, and since both sides hold
+ * ordinary chronos mutexes, priority inheritance and deadlock prevention work
+ * on them exactly as they do on plain mutexes. The price, a known limitation:
+ * - readers whose tids are equal modulo CHRONOS_RWLOCK_SLOTS exclude each
+ *   other like writers;
+ * - a write lock or unlock covers CHRONOS_RWLOCK_SLOTS mutexes where a read
+ *   covers one: one set operation with the sim and user backends, but as many
+ *   system calls on contention with the kernel and deadline backends.
+ * writer holds the tid of the writer while there is one, so an unlock knows
+ * which side it is releasing. */
+#define CHRONOS_RWLOCK_SLOTS		8
+
+struct rwlock_data {
+	chronos_mutex_t slots[CHRONOS_RWLOCK_SLOTS];
+	int writer;
+};
+
+typedef struct rwlock_data chronos_rwlock_t;
+
+/* The cost of the userspace dispatcher */
+struct chronos_dispatch_stats {
+	unsigned long long events;	/* scheduling events handled */
+	unsigned long long prio_changes;/* sched_setscheduler() calls made */
+	unsigned long long total_ns;	/* time spent dispatching */
+	unsigned long long max_ns;	/* longest single dispatch */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -135,6 +193,17 @@ long end_rtseg_self(int prio);
 /* End the real-time portion of another task */
 long end_rtseg(int tid, int prio);
 
+/* End the current job of the calling task, sleep until release (if given)
+ * and begin its next job, all in one call. release is an absolute time on
+ * chronos_deadline_clock. The sim, user and deadline backends do this as one
+ * operation; with the kernel backend (whose system call has no
+ * RT_SEG_NEXT_JOB) it falls back to end_rtseg_self(end_prio),
+ * chronos_clock_nanosleep and begin_rtseg_self. end_prio is only used then,
+ * since the task otherwise stays real-time while it sleeps. */
+long next_rtseg_self(int end_prio, int prio, int max_util,
+		     struct timespec* release, struct timespec* deadline,
+		     struct timespec* period, unsigned long exec_time);
+
 /* Add an abort handler for the task */
 long add_abort_handler_self(int max_util, struct timespec *deadline,
 			 unsigned long exec_time);
@@ -158,6 +227,65 @@ long chronos_mutex_lock(chronos_mutex_t *m);
 long chronos_mutex_unlock(chronos_mutex_t *m);
 int chronos_mutex_owner(chronos_mutex_t *m);
 
+/* Take every lock in a set, or none of them. The locks are always taken in the
+ * same canonical order, so tasks locking overlapping sets through these calls
+ * can't deadlock each other, and released in the reverse order. The sim and
+ * user backends take or release the whole set in one operation, checking for
+ * deadlock over the locks still to be taken; the kernel and deadline backends
+ * take one lock at a time. */
+long chronos_mutex_lock_set(chronos_mutex_t **locks, int n);
+long chronos_mutex_unlock_set(chronos_mutex_t **locks, int n);
+
+long chronos_rwlock_init(chronos_rwlock_t *rw);
+long chronos_rwlock_destroy(chronos_rwlock_t *rw);
+long chronos_rwlock_rdlock(chronos_rwlock_t *rw);
+long chronos_rwlock_wrlock(chronos_rwlock_t *rw);
+long chronos_rwlock_unlock(chronos_rwlock_t *rw);
+
+/* Take every reader/writer lock in a set, or none of them, like
+ * chronos_mutex_lock_set: locks[i] is taken for writing if write[i] is
+ * non-zero (or write is NULL) and for reading otherwise. A lock listed twice
+ * is taken once, for writing if either entry asks for it. */
+long chronos_rwlock_lock_set(chronos_rwlock_t **locks, const int *write, int n);
+long chronos_rwlock_unlock_set(chronos_rwlock_t **locks, int n);
+
+/* Enable (1) or disable (0) the userspace mutex fast path for the kernel
+ * backend, or just query it (-1). It defaults to the CHRONOS_MUTEX_FASTPATH
+ * environment variable, and needs a kernel following the protocol above. */
+int chronos_mutex_fastpath(int enable);
+
+/* Select the backend. This must happen before any thread groups are forked,
+ * since some backends keep state in memory shared between them. */
+int chronos_set_backend(int backend);
+int chronos_get_backend(void);
+int chronos_find_backend(const char *name);
+const char *chronos_backend_name(int backend);
+
+/* Announce the calling thread as a real-time task to the backend, and remove
+ * it again once it will make no more real-time calls */
+long chronos_task_register(void);
+long chronos_task_unregister(void);
+
+/* The clock which absolute deadlines and release times are given on, and
+ * abort times recorded on. The ChronOS kernel measures them on CLOCK_REALTIME;
+ * the other backends use CLOCK_MONOTONIC, which can't be stepped under a
+ * running test. */
+clockid_t chronos_deadline_clock(void);
+
+/* Clock functions which follow the backend's notion of time. These behave
+ * exactly like their libc counterparts for the kernel backend. */
+int chronos_clock_gettime(clockid_t clk, struct timespec *ts);
+int chronos_clock_nanosleep(clockid_t clk, int flags,
+			    const struct timespec *req);
+
+/* Simulation backend only: execute for usec microseconds of virtual time.
+ * Returns non-zero if the current job was aborted. */
+long chronos_sim_consume(unsigned long usec);
+
+/* Userspace dispatcher backend only: read or clear its overhead counters */
+int chronos_get_dispatch_stats(struct chronos_dispatch_stats *stats);
+void chronos_reset_dispatch_stats(void);
+
 #ifdef __cplusplus
 }
 #endif
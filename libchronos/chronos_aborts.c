@@ -20,12 +20,28 @@
  ***************************************************************************/
 
 #include "chronos_aborts.h"
+#include "chronos_backend.h"
+#include <errno.h>
 #include <stdio.h>
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 #define MIN_ABORTABLE_PID 1
 #define DEFAULT_PID_MAX 32768
 static int pid_max = 0; /* Cached copy of /proc/sys/kernel/pid_max */
 
+/* Inherited by forked thread groups, so only set before they are started */
+static int abort_notify = CHRONOS_ABORT_POLL;
+
+/* The slot table, if the backend aborts jobs in userspace. It is mapped before
+ * the thread groups fork, so the backends can keep pointers into it. */
+static struct chronos_abort_slot *abort_slots = NULL;
+
+/* The slot the calling thread registered */
+static __thread struct chronos_abort_slot *self_slot = NULL;
+
 /* Attempt to get and return the value in /proc/sys/kernel/pid_max, but
  * return the default if we fail */
 static int read_pid_max() {
@@ -48,6 +64,43 @@ static int read_pid_max() {
 	return proc_pid_max;
 }
 
+/* Map the slot table for backends which abort jobs themselves. It lives in a
+ * memfd, so no device, module or root is needed, and the table could be handed
+ * to another process by its fd. Kernels without memfd get anonymous shared
+ * memory instead. Returns < 0 on failure, 0 on success */
+static int init_abort_slots(chronos_aborts_t * adata){
+	unsigned int mapsize = CHRONOS_ABORT_MAX_SLOTS * sizeof(struct chronos_abort_slot);
+	char * mmapptr;
+	int fd = -1;
+
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create, "chronos_aborts", MFD_CLOEXEC);
+	if(fd >= 0 && ftruncate(fd, mapsize)) {
+		close(fd);
+		return -1;
+	}
+#endif
+
+	if(fd >= 0)
+		mmapptr = (char *) mmap(0, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	else
+		mmapptr = (char *) mmap(0, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(mmapptr == MAP_FAILED) {
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	abort_slots = (struct chronos_abort_slot *) mmapptr;
+
+	adata->mmap_pointer = mmapptr;
+	adata->fd = fd;
+	adata->mapsize = mapsize;
+	adata->slotted = 1;
+	adata->initialized = 1;
+	return 0;
+}
+
 /* Initialize the aborts for a process by mapping the shared memory into the
  * current process, and return a struct which can be passed to get_abort_ptr on
  * a particular thread/process to get a char pointer for that process to check
@@ -60,8 +113,19 @@ int init_aborts(chronos_aborts_t * adata){
 	if(!adata)
 		return -1;
 
+	adata->slotted = 0;
+
+	/*Backends which abort tasks themselves don't need the device*/
+	if(chronos_backend_ops()->userspace_aborts)
+		return init_abort_slots(adata);
+
 	pid_max = read_pid_max();
 
+	/*Figure out how many pages to allocate based on page size and number of pids */
+	while((1 << pageorder) * pagesize < (pid_max - MIN_ABORTABLE_PID + 1) * sizeof(char))
+		pageorder++;
+	mapsize = (1 << pageorder) * pagesize;
+
 	/*Attempt to open the character device*/
 	fd = open("/dev/aborts", O_RDWR | O_SYNC);
 	if(fd<0){ /*If we failed to open the file, make sure the module is loaded, and try to mknod*/
@@ -74,11 +138,6 @@ int init_aborts(chronos_aborts_t * adata){
 			return -1;
 	}
 
-	/*Figure out how many pages to allocate based on page size and number of pids */
-	while((1 << pageorder) * pagesize < (pid_max - MIN_ABORTABLE_PID + 1) * sizeof(char))
-		pageorder++;
-	mapsize = (1 << pageorder) * pagesize;
-
 	/*Actually map the character device into memory*/
 	mmapptr = (char *) mmap(0, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FILE, fd, 0);
 	if(mmapptr == MAP_FAILED)
@@ -105,11 +164,14 @@ int cleanup_aborts(chronos_aborts_t * adata){
 		return -1;
 
 	pid_max = 0;
+	if(adata->slotted) {
+		abort_slots = NULL;
+		self_slot = NULL;
+	}
 
-	/*unmap*/
 	munmap(adata->mmap_pointer, adata->mapsize);
-	/*close fd*/
-	close(adata->fd);
+	if(adata->fd >= 0)
+		close(adata->fd);
 
 	adata->initialized=0;
 
@@ -119,18 +181,144 @@ int cleanup_aborts(chronos_aborts_t * adata){
 /* Given a pointer to the beginning of the memory block, return a pointer to a
  * character which will be non-zero only when the calling thread is being aborted */
 char *get_abort_ptr(chronos_aborts_t * adata){
-	int tid = syscall(SYS_gettid);
-	if(tid > pid_max || tid < MIN_ABORTABLE_PID)
-		return NULL;
-
-	return get_abort_ptr_tid(adata, tid);
+	return register_abort_slot(adata);
 }
 
 /* Given a pointer to the beginning of the memory block, return a pointer to a
- * character which will be non-zero only when the calling thread is being aborted */
+ * character which will be non-zero only when the given thread is being aborted,
+ * or NULL if it has no slot */
 char *get_abort_ptr_tid(chronos_aborts_t * adata, int tid){
+	struct chronos_abort_slot *slot;
+
 	if(!adata || !adata->initialized)
 		return NULL;
 
+	if(adata->slotted) {
+		slot = chronos_abort_slot(tid, NULL);
+		return slot ? &slot->aborted : NULL;
+	}
+
+	if(tid > pid_max || tid < MIN_ABORTABLE_PID)
+		return NULL;
 	return adata->mmap_pointer+tid-MIN_ABORTABLE_PID;
 }
+
+/* Claim a free slot for the calling thread and return its abort byte. With
+ * the device, every tid already has its byte. Returns NULL if the table is
+ * full. */
+char *register_abort_slot(chronos_aborts_t * adata){
+	int i, tid = chronos_self_tid();
+
+	if(!adata || !adata->initialized)
+		return NULL;
+	if(!adata->slotted)
+		return get_abort_ptr_tid(adata, tid);
+
+	/*a forked thread group leader inherits its parent's slot pointer*/
+	if(self_slot && self_slot->tid == tid)
+		return &self_slot->aborted;
+
+	for(i = 0; i < CHRONOS_ABORT_MAX_SLOTS; i++) {
+		if(__sync_bool_compare_and_swap(&abort_slots[i].tid, 0, tid)) {
+			self_slot = &abort_slots[i];
+			return &self_slot->aborted;
+		}
+	}
+
+	return NULL;
+}
+
+/* Give the calling thread's slot back. Returns < 0 if it had none. */
+int unregister_abort_slot(chronos_aborts_t * adata){
+	int tid = chronos_self_tid();
+
+	if(!adata || !adata->initialized)
+		return -1;
+	if(!adata->slotted)
+		return 0;
+	if(!self_slot || self_slot->tid != tid)
+		return -1;
+
+	/*the slot must be clean before anyone else can claim it*/
+	self_slot->aborted = 0;
+	self_slot->abort_time = 0;
+	__sync_synchronize();
+	self_slot->tid = 0;
+	self_slot = NULL;
+	return 0;
+}
+
+/* Select how aborts are delivered. The kernel sets abort bytes itself and
+ * can't be asked to signal, so only the userspace backends support
+ * CHRONOS_ABORT_SIGNAL. Returns < 0 on failure, 0 on success */
+int set_abort_notify(int mode){
+	if(mode != CHRONOS_ABORT_POLL && mode != CHRONOS_ABORT_SIGNAL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(mode == CHRONOS_ABORT_SIGNAL &&
+	   !chronos_backend_ops()->userspace_aborts) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	abort_notify = mode;
+	return 0;
+}
+
+int get_abort_notify(void){
+	return abort_notify;
+}
+
+/* Return when the calling thread's abort byte was last set, or 0 if the
+ * backend which set it doesn't record that */
+long long get_abort_time(chronos_aborts_t * adata){
+	if(!adata || !adata->initialized || !adata->slotted ||
+	   !self_slot || self_slot->tid != chronos_self_tid())
+		return 0;
+
+	return self_slot->abort_time;
+}
+
+/* Find the slot tid registered. A backend passes the slot it found last time
+ * for that task in *cache, which saves the search while it is still valid. */
+struct chronos_abort_slot *chronos_abort_slot(int tid, struct chronos_abort_slot **cache){
+	int i;
+
+	if(!abort_slots)
+		return NULL;
+	if(cache && *cache && (*cache)->tid == tid)
+		return *cache;
+
+	for(i = 0; i < CHRONOS_ABORT_MAX_SLOTS; i++) {
+		if(abort_slots[i].tid == tid) {
+			if(cache)
+				*cache = &abort_slots[i];
+			return &abort_slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Set or clear tid's abort byte from a userspace backend. Setting it notes
+ * the time on the backend's clock, and signals the task if it asked to be. */
+void chronos_set_aborted(int tid, struct chronos_abort_slot **cache, int aborted,
+			 long long now_ns){
+	struct chronos_abort_slot *slot = chronos_abort_slot(tid, cache);
+
+	if(!slot)
+		return;
+
+	if(!aborted) {
+		slot->aborted = 0;
+		return;
+	}
+
+	slot->abort_time = now_ns;
+	slot->aborted = 1;
+
+	if(abort_notify == CHRONOS_ABORT_SIGNAL)
+		syscall(SYS_tkill, tid, CHRONOS_ABORT_SIGNO);
+}
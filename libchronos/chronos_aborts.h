@@ -29,13 +29,36 @@
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <fcntl.h>
+#include <signal.h>
+
+/*How a thread learns that its job was aborted: it always polls its abort byte,
+ * and with CHRONOS_ABORT_SIGNAL it is also sent CHRONOS_ABORT_SIGNO when a
+ * backend sets the byte from userspace*/
+#define CHRONOS_ABORT_POLL	0
+#define CHRONOS_ABORT_SIGNAL	1
+
+#define CHRONOS_ABORT_SIGNO	(SIGRTMIN + 1)
+
+/*Backends which abort jobs in userspace give each registered thread a slot of
+ * its own in a compact table, a cache line apiece so that setting one task's
+ * abort byte doesn't disturb the lines other tasks are polling. The ChronOS
+ * kernel writes /dev/aborts by tid instead, where the bytes stay packed.*/
+#define CHRONOS_ABORT_SLOT_SIZE		64
+#define CHRONOS_ABORT_MAX_SLOTS		4096
+
+struct chronos_abort_slot{
+	char aborted;		/*the byte get_abort_ptr returns*/
+	int tid;		/*0 while the slot is free*/
+	long long abort_time;	/*nsec on the deadline clock the job was last aborted*/
+} __attribute__((aligned(CHRONOS_ABORT_SLOT_SIZE)));
 
 /*Structure to hold the data surrounding the shared memory for a particular process*/
 struct chronos_aborts_data{
-	char * mmap_pointer;
+	char * mmap_pointer;	/*the tid-indexed device map, or the slot table*/
 	int fd;
 	unsigned int mapsize;
 	char initialized;
+	char slotted;		/*mmap_pointer holds abort slots*/
 };
 
 typedef struct chronos_aborts_data chronos_aborts_t;
@@ -54,6 +77,21 @@ int cleanup_aborts(chronos_aborts_t * adata);
 char *get_abort_ptr(chronos_aborts_t * adata);
 char *get_abort_ptr_tid(chronos_aborts_t * adata, int tid);
 
+/* Claim an abort slot for the calling thread and return its abort byte, or
+ * release it again once the thread is done with real-time work. get_abort_ptr
+ * registers implicitly. */
+char *register_abort_slot(chronos_aborts_t * adata);
+int unregister_abort_slot(chronos_aborts_t * adata);
+
+/* Select how aborts are delivered, before any tasks are started. Returns < 0
+ * if the selected backend can't deliver signals */
+int set_abort_notify(int mode);
+int get_abort_notify(void);
+
+/* Return the time (in nsec, on chronos_deadline_clock) at which the calling
+ * thread's abort byte was last set, or 0 if the backend doesn't record it */
+long long get_abort_time(chronos_aborts_t * adata);
+
 #ifdef __cplusplus
 }
 #endif
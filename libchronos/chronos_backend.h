@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab	   *
+ *									   *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or	   *
+ *   (at your option) any later version.				   *
+ *									   *
+ *   This program is distributed in the hope that it will be useful,	   *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of	   *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the	   *
+ *   GNU General Public License for more details.			   *
+ *									   *
+ *   You should have received a copy of the GNU General Public License	   *
+ *   along with this program; if not, write to the			   *
+ *   Free Software Foundation, Inc.,					   *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
+ ***************************************************************************/
+
+#ifndef CHRONOS_BACKEND_H
+#define CHRONOS_BACKEND_H
+
+#include <limits.h>
+
+#include "chronos.h"
+#include "chronos_aborts.h"
+
+/* The operations a libchronos backend provides. The public entry points in
+ * chronos.c marshal their arguments exactly as they would for the ChronOS
+ * system calls and hand them to the selected backend. Any operation left NULL
+ * falls back to the default behaviour (the real system call, or the plain libc
+ * function for the clock operations).
+ */
+struct chronos_backend {
+	const char *name;
+
+	/* Called once when the backend is selected. This runs in the process
+	 * that selects the backend, so any state that must be shared with
+	 * forked thread groups has to be set up here. */
+	int (*init) (void);
+
+	long (*do_rt_seg) (int op, struct rt_data *data);
+	long (*do_chronos_mutex) (chronos_mutex_t *m, int op);
+	/* CHRONOS_MUTEX_REQUEST or _RELEASE of n distinct locks, sorted by
+	 * address, all at once. Without it each lock is taken on its own. */
+	long (*do_chronos_mutex_set) (chronos_mutex_t **locks, int n, int op);
+	long (*set_scheduler) (int scheduler, int prio, unsigned long cpus);
+
+	long (*task_register) (void);
+	long (*task_unregister) (void);
+
+	int (*clock_gettime) (clockid_t clk, struct timespec *ts);
+	int (*clock_nanosleep) (clockid_t clk, int flags,
+				const struct timespec *req);
+
+	/* Set if the backend aborts jobs itself (or never does), so tasks get
+	 * abort slots from chronos_aborts.c rather than /dev/aborts */
+	int userspace_aborts;
+
+	/* The clock absolute deadlines, releases and abort times are on */
+	clockid_t deadline_clock;
+};
+
+/* The real-time parameters of a job, as given to begin_rtseg, kept by the
+ * backends which schedule jobs themselves */
+struct chronos_job {
+	int in_rtseg;
+	int prio;
+	unsigned int max_util;
+	long long exec_ns;
+	long long deadline_ns;
+	long long period_ns;
+	unsigned long seq;	/* orders jobs of equal priority under FIFO */
+};
+
+/* The key of a job which is not in a real-time segment */
+#define CHRONOS_KEY_IDLE		LLONG_MAX
+
+static inline long long timespec_to_ns(const struct timespec *ts) {
+	return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static inline void ns_to_timespec(long long ns, struct timespec *ts) {
+	ts->tv_sec = ns / 1000000000LL;
+	ts->tv_nsec = ns % 1000000000LL;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct chronos_backend chronos_kernel_backend;
+extern struct chronos_backend chronos_sim_backend;
+extern struct chronos_backend chronos_user_backend;
+extern struct chronos_backend chronos_deadline_backend;
+
+/* Fill in a job from the arguments to begin_rtseg */
+void chronos_job_begin(struct chronos_job *job, struct rt_data *data,
+		       unsigned long seq);
+
+/* The key a scheduler orders jobs by: the job with the smallest key runs
+ * first */
+long long chronos_job_key(int scheduler, struct chronos_job *job);
+
+/* The tid of the calling thread, without a system call after the first */
+int chronos_self_tid(void);
+
+/* The backend in use, selecting the default on first use */
+struct chronos_backend *chronos_backend_ops(void);
+
+/* chronos_clock_nanosleep on the real clock, for backends that keep their own
+ * time but also serve threads outside it */
+int chronos_real_nanosleep(clockid_t clk, int flags,
+			   const struct timespec *req);
+
+/* The abort slot tid registered, or NULL. If cache is given, it holds the
+ * slot last found for the same task. */
+struct chronos_abort_slot *chronos_abort_slot(int tid,
+					      struct chronos_abort_slot **cache);
+
+/* Set or clear the abort byte of tid's job. Setting it records now_ns, the
+ * backend's time on its deadline clock, and delivers the abort signal if that
+ * has been selected (see set_abort_notify) */
+void chronos_set_aborted(int tid, struct chronos_abort_slot **cache,
+			 int aborted, long long now_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHRONOS_BACKEND_H */
@@ -0,0 +1,219 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab	   *
+ *									   *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or	   *
+ *   (at your option) any later version.				   *
+ *									   *
+ *   This program is distributed in the hope that it will be useful,	   *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of	   *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the	   *
+ *   GNU General Public License for more details.			   *
+ *									   *
+ *   You should have received a copy of the GNU General Public License	   *
+ *   along with this program; if not, write to the			   *
+ *   Free Software Foundation, Inc.,					   *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
+ ***************************************************************************/
+
+/*
+ * SCHED_DEADLINE backend. Jobs are handed to the mainline EDF/CBS scheduler:
+ * begin_rtseg turns the exec time, deadline and period of the job into the
+ * runtime, relative deadline and period of the calling thread. Since the
+ * tasksets are periodic, the parameters stay the same from one job to the
+ * next and the kernel replenishes the budget itself each time the task wakes
+ * up for its next release, so sched_setattr() is only called again when they
+ * change. Locks are PI futexes, which give deadline inheritance.
+ *
+ * Only EDF can be selected, and each thread must be allowed to run on every
+ * CPU of its root domain. Mainline has no abort mechanism, so no job is ever
+ * aborted.
+ */
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include "chronos.h"
+#include "chronos_backend.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+
+/* The kernel rejects runtimes below this */
+#define DL_MIN_RUNTIME_NS	1024LL
+
+/* The relative deadline of each job is measured from when begin_rtseg is
+ * called, so it jitters slightly with the wakeup latency. Changes smaller than
+ * this don't warrant new parameters. */
+#define DL_DEADLINE_SLACK_NS	100000LL
+
+/* The exec time of a job is exactly what it consumes, so any overhead would
+ * overrun the budget and throttle the task until its next period. Let it
+ * reclaim bandwidth the other tasks leave unused instead (GRUB). */
+#ifndef SCHED_FLAG_RECLAIM
+#define SCHED_FLAG_RECLAIM	0x02
+#endif
+
+struct dl_sched_attr {
+	u_int32_t size;
+	u_int32_t sched_policy;
+	u_int64_t sched_flags;
+	int32_t sched_nice;
+	u_int32_t sched_priority;
+	u_int64_t sched_runtime;
+	u_int64_t sched_deadline;
+	u_int64_t sched_period;
+};
+
+/* The parameters the calling thread last got */
+static __thread long long dl_runtime = 0;
+static __thread long long dl_deadline = 0;
+static __thread long long dl_period = 0;
+
+static long dl_setattr(int tid, long long runtime, long long deadline,
+		       long long period) {
+	struct dl_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_runtime = runtime;
+	attr.sched_deadline = deadline;
+	attr.sched_period = period;
+	attr.sched_flags = SCHED_FLAG_RECLAIM;
+
+	if(!syscall(SYS_sched_setattr, tid, &attr, 0))
+		return 0;
+
+	/* Kernels before 4.13 can't reclaim */
+	if(errno != EINVAL)
+		return -1;
+	attr.sched_flags = 0;
+	return syscall(SYS_sched_setattr, tid, &attr, 0);
+}
+
+static long dl_do_rt_seg(int op, struct rt_data *data) {
+	struct chronos_job job;
+	struct timespec now;
+	long long runtime, deadline, period, diff;
+
+	switch(op) {
+	case RT_SEG_BEGIN:
+		break;
+	case RT_SEG_NEXT_JOB:
+		/* Ending the job is a no-op, so this is a sleep and a begin */
+		if(data->release &&
+		   chronos_clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					   data->release))
+			return -1;
+		break;
+	case RT_SEG_END:
+	case RT_SEG_ADD_ABORT:
+		/* The thread stays under SCHED_DEADLINE between jobs */
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The per-thread cache only describes the calling thread */
+	if(data->tid && data->tid != chronos_self_tid()) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	chronos_job_begin(&job, data, 0);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* runtime <= deadline <= period, as the kernel requires */
+	runtime = job.exec_ns < DL_MIN_RUNTIME_NS ? DL_MIN_RUNTIME_NS : job.exec_ns;
+	period = job.period_ns == LLONG_MAX ? 0 : job.period_ns;
+	deadline = job.deadline_ns == LLONG_MAX ? period :
+		   job.deadline_ns - timespec_to_ns(&now);
+	if(period && deadline > period)
+		deadline = period;
+	if(deadline < runtime)
+		deadline = runtime;
+	if(period && period < deadline)
+		period = deadline;
+
+	diff = deadline - dl_deadline;
+	if(runtime == dl_runtime && period == dl_period &&
+	   diff > -DL_DEADLINE_SLACK_NS && diff < DL_DEADLINE_SLACK_NS)
+		return 0;
+
+	if(dl_setattr(0, runtime, deadline, period))
+		return -1;
+
+	dl_runtime = runtime;
+	dl_deadline = deadline;
+	dl_period = period;
+	return 0;
+}
+
+/* Locks are PI futexes: value holds the owner's tid, with FUTEX_WAITERS set
+ * once somebody blocks on it, and the kernel only gets involved then */
+static long dl_do_chronos_mutex(chronos_mutex_t *m, int op) {
+	int tid = chronos_self_tid();
+
+	switch(op) {
+	case CHRONOS_MUTEX_INIT:
+		m->value = 0;
+		m->owner = 0;
+		m->id = (unsigned long)m;
+		return 0;
+	case CHRONOS_MUTEX_DESTROY:
+		return 0;
+	case CHRONOS_MUTEX_REQUEST:
+		if(__sync_bool_compare_and_swap(&m->value, 0, tid)) {
+			m->owner = tid;
+			return 0;
+		}
+
+		if(syscall(SYS_futex, &m->value, FUTEX_LOCK_PI, 0, NULL, NULL, 0))
+			return -1;
+		m->owner = tid;
+		return 0;
+	case CHRONOS_MUTEX_RELEASE:
+		if(m->owner != tid) {
+			errno = EPERM;
+			return -1;
+		}
+
+		m->owner = 0;
+		if(__sync_bool_compare_and_swap(&m->value, tid, 0))
+			return 0;
+		return syscall(SYS_futex, &m->value, FUTEX_UNLOCK_PI, 0, NULL,
+			       NULL, 0);
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static long dl_set_scheduler(int scheduler, int prio, unsigned long cpus) {
+	if((scheduler & ~SCHED_FLAGS_MASK) != SCHED_RT_EDF) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+struct chronos_backend chronos_deadline_backend = {
+	"deadline",
+	NULL,
+	dl_do_rt_seg,
+	dl_do_chronos_mutex,
+	NULL,
+	dl_set_scheduler,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	1,
+	CLOCK_MONOTONIC
+};
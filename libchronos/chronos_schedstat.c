@@ -0,0 +1,205 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab	   *
+ *									   *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or	   *
+ *   (at your option) any later version.				   *
+ *									   *
+ *   This program is distributed in the hope that it will be useful,	   *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of	   *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the	   *
+ *   GNU General Public License for more details.			   *
+ *									   *
+ *   You should have received a copy of the GNU General Public License	   *
+ *   along with this program; if not, write to the			   *
+ *   Free Software Foundation, Inc.,					   *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
+ ***************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "chronos_schedstat.h"
+
+#define SCHEDSTAT_LINE_SIZE	512
+
+/* Read the per-CPU lines of /proc/schedstat (version 15 and later):
+ * cpu<N> yld_count 0 sched_count sched_goidle ttwu_count ttwu_local
+ * rq_cpu_time run_delay pcount */
+static void read_cpu_schedstat(struct chronos_schedstat *stats) {
+	char line[SCHEDSTAT_LINE_SIZE];
+	struct chronos_cpu_schedstat c;
+	unsigned long long unused;
+	int cpu, version = 0;
+	FILE *f;
+
+	stats->num_cpus = 0;
+	if(!(f = fopen("/proc/schedstat", "r")))
+		return;
+
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "version %d", &version) == 1)
+			continue;
+		if(version < 15 || sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+					   &cpu, &c.yields, &unused, &c.schedules,
+					   &c.idle, &c.wakeups, &unused, &c.run_ns,
+					   &c.delay_ns, &c.timeslices) != 10)
+			continue;
+		if(cpu < 0 || cpu >= CHRONOS_SCHEDSTAT_MAX_CPUS)
+			continue;
+		stats->cpus[cpu] = c;
+		if(cpu >= stats->num_cpus)
+			stats->num_cpus = cpu + 1;
+	}
+	fclose(f);
+}
+
+static void read_context_switches(struct chronos_schedstat *stats) {
+	char line[SCHEDSTAT_LINE_SIZE];
+	FILE *f;
+
+	stats->context_switches = -1;
+	if(!(f = fopen("/proc/stat", "r")))
+		return;
+
+	while(fgets(line, sizeof(line), f))
+		if(sscanf(line, "ctxt %lld", &stats->context_switches) == 1)
+			break;
+	fclose(f);
+}
+
+/* Every entry of CHRONOS_PROC_DIR which holds a single number */
+static void read_chronos_counters(struct chronos_schedstat *stats) {
+	char path[sizeof(CHRONOS_PROC_DIR) + 256];
+	struct chronos_counter *c;
+	struct dirent *ent;
+	DIR *dir;
+	FILE *f;
+
+	stats->num_counters = 0;
+	if(!(dir = opendir(CHRONOS_PROC_DIR)))
+		return;
+
+	while((ent = readdir(dir)) &&
+	      stats->num_counters < CHRONOS_SCHEDSTAT_MAX_COUNTERS) {
+		if(ent->d_name[0] == '.' ||
+		   strlen(ent->d_name) >= CHRONOS_SCHEDSTAT_NAME_SIZE)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", CHRONOS_PROC_DIR, ent->d_name);
+		if(!(f = fopen(path, "r")))
+			continue;
+
+		c = &stats->counters[stats->num_counters];
+		if(fscanf(f, "%lld", &c->value) == 1) {
+			strcpy(c->name, ent->d_name);
+			stats->num_counters++;
+		}
+		fclose(f);
+	}
+	closedir(dir);
+}
+
+int chronos_schedstat_snapshot(struct chronos_schedstat *stats) {
+	read_cpu_schedstat(stats);
+	read_context_switches(stats);
+	read_chronos_counters(stats);
+
+	if(!stats->num_cpus && stats->context_switches == -1 &&
+	   !stats->num_counters) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+void chronos_schedstat_diff(struct chronos_schedstat *diff,
+			    const struct chronos_schedstat *before,
+			    const struct chronos_schedstat *after) {
+	int i, j;
+
+	diff->num_cpus = after->num_cpus < before->num_cpus ?
+			 after->num_cpus : before->num_cpus;
+	for(i = 0; i < diff->num_cpus; i++) {
+		const struct chronos_cpu_schedstat *b = &before->cpus[i];
+		const struct chronos_cpu_schedstat *a = &after->cpus[i];
+		struct chronos_cpu_schedstat *d = &diff->cpus[i];
+
+		d->yields = a->yields - b->yields;
+		d->schedules = a->schedules - b->schedules;
+		d->idle = a->idle - b->idle;
+		d->wakeups = a->wakeups - b->wakeups;
+		d->run_ns = a->run_ns - b->run_ns;
+		d->delay_ns = a->delay_ns - b->delay_ns;
+		d->timeslices = a->timeslices - b->timeslices;
+	}
+
+	if(before->context_switches == -1 || after->context_switches == -1)
+		diff->context_switches = -1;
+	else
+		diff->context_switches = after->context_switches -
+					 before->context_switches;
+
+	diff->num_counters = after->num_counters;
+	for(i = 0; i < after->num_counters; i++) {
+		diff->counters[i] = after->counters[i];
+		for(j = 0; j < before->num_counters; j++)
+			if(!strcmp(before->counters[j].name, after->counters[i].name))
+				diff->counters[i].value -= before->counters[j].value;
+	}
+}
+
+int chronos_thread_schedstat(pid_t tid, struct chronos_thread_schedstat *stats) {
+	char path[64], line[SCHEDSTAT_LINE_SIZE];
+	int found = 0;
+	FILE *f;
+
+	if(tid)
+		snprintf(path, sizeof(path), "/proc/%d/schedstat", tid);
+	else
+		strcpy(path, "/proc/thread-self/schedstat");
+	if(!(f = fopen(path, "r")))
+		return -1;
+	if(fscanf(f, "%llu %llu %llu", &stats->run_ns, &stats->delay_ns,
+		  &stats->timeslices) != 3) {
+		fclose(f);
+		errno = EINVAL;
+		return -1;
+	}
+	fclose(f);
+
+	if(tid)
+		snprintf(path, sizeof(path), "/proc/%d/status", tid);
+	else
+		strcpy(path, "/proc/thread-self/status");
+	if(!(f = fopen(path, "r")))
+		return -1;
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "voluntary_ctxt_switches: %llu",
+			  &stats->voluntary_switches) == 1)
+			found++;
+		if(sscanf(line, "nonvoluntary_ctxt_switches: %llu",
+			  &stats->involuntary_switches) == 1)
+			found++;
+	}
+	fclose(f);
+
+	if(found != 2) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+void chronos_thread_schedstat_diff(struct chronos_thread_schedstat *diff,
+				   const struct chronos_thread_schedstat *before,
+				   const struct chronos_thread_schedstat *after) {
+	diff->run_ns = after->run_ns - before->run_ns;
+	diff->delay_ns = after->delay_ns - before->delay_ns;
+	diff->timeslices = after->timeslices - before->timeslices;
+	diff->voluntary_switches = after->voluntary_switches -
+				   before->voluntary_switches;
+	diff->involuntary_switches = after->involuntary_switches -
+				     before->involuntary_switches;
+}
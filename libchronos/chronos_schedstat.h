@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab	   *
+ *									   *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or	   *
+ *   (at your option) any later version.				   *
+ *									   *
+ *   This program is distributed in the hope that it will be useful,	   *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of	   *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the	   *
+ *   GNU General Public License for more details.			   *
+ *									   *
+ *   You should have received a copy of the GNU General Public License	   *
+ *   along with this program; if not, write to the			   *
+ *   Free Software Foundation, Inc.,					   *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
+ ***************************************************************************/
+
+#ifndef CHRONOS_SCHEDSTAT_H
+#define CHRONOS_SCHEDSTAT_H
+
+#include <sys/types.h>
+
+/*Snapshots of the scheduler's statistics, taken before and after a run and
+ * subtracted, so that nothing needs to clear them in between. The system-wide
+ * ones come from /proc/schedstat (which needs CONFIG_SCHEDSTATS), /proc/stat
+ * and every numeric entry of CHRONOS_PROC_DIR, where the ChronOS kernel keeps
+ * its own; those a kernel doesn't have are left out of the snapshot.*/
+#define CHRONOS_PROC_DIR		"/proc/sys/chronos"
+#define CHRONOS_SCHEDSTAT_MAX_CPUS	256
+#define CHRONOS_SCHEDSTAT_MAX_COUNTERS	32
+#define CHRONOS_SCHEDSTAT_NAME_SIZE	32
+
+struct chronos_cpu_schedstat {
+	unsigned long long yields;	/* sched_yield() calls */
+	unsigned long long schedules;	/* schedule() calls */
+	unsigned long long idle;	/* of which switched to the idle task */
+	unsigned long long wakeups;	/* try_to_wake_up() calls */
+	unsigned long long run_ns;	/* time tasks spent running */
+	unsigned long long delay_ns;	/* time runnable tasks waited to run */
+	unsigned long long timeslices;
+};
+
+struct chronos_counter {
+	char name[CHRONOS_SCHEDSTAT_NAME_SIZE];
+	long long value;
+};
+
+struct chronos_schedstat {
+	int num_cpus;		/* 0 if /proc/schedstat can't be read */
+	struct chronos_cpu_schedstat cpus[CHRONOS_SCHEDSTAT_MAX_CPUS];
+	long long context_switches;	/* on all CPUs, -1 if unknown */
+	int num_counters;
+	struct chronos_counter counters[CHRONOS_SCHEDSTAT_MAX_COUNTERS];
+};
+
+/*What the scheduler has counted for one thread, from /proc/<tid>/schedstat
+ * and /proc/<tid>/status*/
+struct chronos_thread_schedstat {
+	unsigned long long run_ns;
+	unsigned long long delay_ns;	/* runnable, but waiting to run */
+	unsigned long long timeslices;
+	unsigned long long voluntary_switches;
+	unsigned long long involuntary_switches;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Snapshot the system-wide statistics. Returns -1 if none could be read */
+int chronos_schedstat_snapshot(struct chronos_schedstat *stats);
+
+/* Work out what was counted between two snapshots. A ChronOS counter which is
+ * missing from before is taken as it is in after */
+void chronos_schedstat_diff(struct chronos_schedstat *diff,
+			    const struct chronos_schedstat *before,
+			    const struct chronos_schedstat *after);
+
+/* Snapshot the statistics of thread tid (0 for the calling thread). Returns -1
+ * if they can't be read */
+int chronos_thread_schedstat(pid_t tid, struct chronos_thread_schedstat *stats);
+
+void chronos_thread_schedstat_diff(struct chronos_thread_schedstat *diff,
+				   const struct chronos_thread_schedstat *before,
+				   const struct chronos_thread_schedstat *after);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,733 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab	   *
+ *									   *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or	   *
+ *   (at your option) any later version.				   *
+ *									   *
+ *   This program is distributed in the hope that it will be useful,	   *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of	   *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the	   *
+ *   GNU General Public License for more details.			   *
+ *									   *
+ *   You should have received a copy of the GNU General Public License	   *
+ *   along with this program; if not, write to the			   *
+ *   Free Software Foundation, Inc.,					   *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
+ ***************************************************************************/
+
+/*
+ * Discrete-event simulation backend. Real-time tasks are real threads, but
+ * they never burn real CPU time: they ask for virtual CPU time with
+ * chronos_sim_consume() and sleep in virtual time with
+ * chronos_clock_nanosleep(). Virtual time only moves forward when every
+ * registered task is waiting inside one of these calls, at which point the
+ * simulator picks the tasks that would be running under the configured
+ * scheduler on each domain and jumps straight to the next event (a task
+ * finishing its request, or a sleeping task waking up).
+ *
+ * All state lives in one shared mapping created when the backend is selected,
+ * so thread groups forked afterwards take part in the same simulation.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chronos.h"
+#include "chronos_backend.h"
+
+#define SIM_MAX_TASKS		4096
+#define SIM_MAX_DOMAINS		64
+
+/* Task states. A task is OUTSIDE while it is executing its own code, which
+ * takes no virtual time at all. */
+#define SIM_UNUSED		0
+#define SIM_OUTSIDE		1
+#define SIM_RUNNING		2
+#define SIM_SLEEPING		3
+#define SIM_BLOCKED		4
+
+struct sim_domain {
+	unsigned long mask;
+	int scheduler;
+	int ncpus;
+};
+
+struct sim_task {
+	pthread_cond_t wake;
+	int tid;
+	int state;
+	int domain;
+
+	struct chronos_job job;	/* the current job */
+	long long consumed_ns;
+	int aborted;
+	struct chronos_abort_slot *abort_slot;
+
+	long long want_ns;	/* virtual CPU time still owed to this request */
+	long long wake_ns;	/* when a sleeping task wakes up */
+	chronos_mutex_t *blocked_on;
+	long ret;		/* handed back to the task when it is woken */
+
+	long long key;		/* scheduling key, smaller runs first */
+};
+
+struct sim_state {
+	pthread_mutex_t lock;
+	long long now_ns;
+	unsigned long seq;
+	int num_tasks;		/* registered tasks */
+	int num_outside;	/* registered tasks not waiting on the simulator */
+	int max_task;		/* one past the highest slot in use */
+
+	int num_domains;
+	struct sim_domain domains[SIM_MAX_DOMAINS];
+	struct sim_task tasks[SIM_MAX_TASKS];
+};
+
+static struct sim_state *sim = NULL;
+static __thread int sim_self = -1;
+
+static int sim_init(void) {
+	pthread_mutexattr_t mattr;
+	struct timespec now;
+
+	if(sim)
+		return 0;
+
+	sim = (struct sim_state *) mmap(NULL, sizeof(struct sim_state),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(sim == MAP_FAILED) {
+		sim = NULL;
+		return -1;
+	}
+
+	memset(sim, 0, sizeof(struct sim_state));
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&sim->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	/* Start virtual time at the monotonic clock so timestamps look sensible */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sim->now_ns = timespec_to_ns(&now);
+
+	return 0;
+}
+
+static struct sim_task *find_task(int tid) {
+	int i;
+
+	if(!tid || tid == chronos_self_tid())
+		return sim_self >= 0 ? &sim->tasks[sim_self] : NULL;
+
+	for(i = 0; i < sim->max_task; i++) {
+		if(sim->tasks[i].state != SIM_UNUSED && sim->tasks[i].tid == tid)
+			return &sim->tasks[i];
+	}
+	return NULL;
+}
+
+static int popcount(unsigned long mask) {
+	int n = 0;
+
+	for(; mask; mask &= mask - 1)
+		n++;
+	return n;
+}
+
+/* Find the domain for a cpu mask, preferring an exact match */
+static int find_domain(unsigned long mask) {
+	int i;
+
+	for(i = 0; i < sim->num_domains; i++) {
+		if(sim->domains[i].mask == mask)
+			return i;
+	}
+
+	for(i = 0; i < sim->num_domains; i++) {
+		if(sim->domains[i].mask & mask)
+			return i;
+	}
+	return -1;
+}
+
+static int add_domain(unsigned long mask, int scheduler) {
+	int d = find_domain(mask);
+
+	if(d < 0 || sim->domains[d].mask != mask) {
+		if(sim->num_domains == SIM_MAX_DOMAINS)
+			return -1;
+		d = sim->num_domains++;
+	}
+
+	sim->domains[d].mask = mask;
+	sim->domains[d].scheduler = scheduler;
+	sim->domains[d].ncpus = popcount(mask);
+	return d;
+}
+
+/* Compute every task's key, passing the keys of blocked tasks on to the lock
+ * owners if priority inheritance is enabled on the owner's domain */
+static void compute_keys(void) {
+	int i, pass, changed;
+
+	for(i = 0; i < sim->max_task; i++) {
+		if(sim->tasks[i].state != SIM_UNUSED)
+			sim->tasks[i].key = chronos_job_key(
+					sim->domains[sim->tasks[i].domain].scheduler,
+					&sim->tasks[i].job);
+	}
+
+	for(pass = 0, changed = 1; changed && pass < 16; pass++) {
+		changed = 0;
+		for(i = 0; i < sim->max_task; i++) {
+			struct sim_task *w = &sim->tasks[i], *o;
+
+			if(w->state != SIM_BLOCKED)
+				continue;
+			o = find_task(w->blocked_on->owner);
+			if(!o || !(sim->domains[o->domain].scheduler & SCHED_FLAG_PI))
+				continue;
+			if(w->key < o->key) {
+				o->key = w->key;
+				changed = 1;
+			}
+		}
+	}
+}
+
+/* Hand a task back to its own code */
+static void release_task(struct sim_task *t, long ret) {
+	t->state = SIM_OUTSIDE;
+	t->ret = ret;
+	t->want_ns = 0;
+	sim->num_outside++;
+	pthread_cond_signal(&t->wake);
+}
+
+static void abort_task(struct sim_task *t) {
+	t->aborted = 1;
+	chronos_set_aborted(t->tid, &t->abort_slot, 1, sim->now_ns);
+	release_task(t, 1);
+}
+
+/* Choose the tasks which are running on each domain right now. Returns the
+ * number of running tasks. running[] must hold SIM_MAX_TASKS entries. */
+static int pick_running(int *running) {
+	int d, i, n = 0;
+
+	compute_keys();
+
+	for(d = 0; d < sim->num_domains; d++) {
+		int cpu;
+
+		for(cpu = 0; cpu < sim->domains[d].ncpus; cpu++) {
+			int best = -1;
+
+			for(i = 0; i < sim->max_task; i++) {
+				struct sim_task *t = &sim->tasks[i];
+				int j, taken = 0;
+
+				if(t->state != SIM_RUNNING || t->domain != d)
+					continue;
+				for(j = 0; j < n; j++)
+					taken |= (running[j] == i);
+				if(taken)
+					continue;
+				if(best < 0 || t->key < sim->tasks[best].key)
+					best = i;
+			}
+
+			if(best < 0)
+				break;
+			running[n++] = best;
+		}
+	}
+
+	return n;
+}
+
+/* Abort jobs which can no longer meet their deadlines, for the schedulers
+ * which do that. Returns the number of jobs aborted. */
+static int abort_infeasible(void) {
+	int i, n = 0;
+
+	for(i = 0; i < sim->max_task; i++) {
+		struct sim_task *t = &sim->tasks[i];
+		int sched;
+
+		if(t->state != SIM_RUNNING || !t->job.in_rtseg || t->aborted)
+			continue;
+
+		sched = sim->domains[t->domain].scheduler & ~SCHED_FLAGS_MASK;
+		if(sched != SCHED_RT_HVDF)
+			continue;
+
+		if(sim->now_ns + t->job.exec_ns - t->consumed_ns >
+		   t->job.deadline_ns) {
+			abort_task(t);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/* Advance virtual time until some task has to run its own code again. Must
+ * be called with sim->lock held. */
+static void sim_advance(void) {
+	static int running[SIM_MAX_TASKS];
+
+	while(sim->num_outside == 0 && sim->num_tasks > 0) {
+		long long next = LLONG_MAX, dt;
+		int i, n;
+
+		if(abort_infeasible())
+			break;
+
+		n = pick_running(running);
+
+		for(i = 0; i < n; i++) {
+			struct sim_task *t = &sim->tasks[running[i]];
+			if(sim->now_ns + t->want_ns < next)
+				next = sim->now_ns + t->want_ns;
+		}
+
+		for(i = 0; i < sim->max_task; i++) {
+			struct sim_task *t = &sim->tasks[i];
+			if(t->state == SIM_SLEEPING && t->wake_ns < next)
+				next = t->wake_ns;
+		}
+
+		/* Nothing can ever happen again: every task is blocked on a
+		 * lock. Fail the lock requests rather than hang forever. */
+		if(next == LLONG_MAX) {
+			for(i = 0; i < sim->max_task; i++) {
+				if(sim->tasks[i].state == SIM_BLOCKED) {
+					sim->tasks[i].blocked_on = NULL;
+					release_task(&sim->tasks[i], -1);
+				}
+			}
+			break;
+		}
+
+		if(next < sim->now_ns)
+			next = sim->now_ns;
+		dt = next - sim->now_ns;
+		sim->now_ns = next;
+
+		for(i = 0; i < n; i++) {
+			struct sim_task *t = &sim->tasks[running[i]];
+			t->want_ns -= dt;
+			t->consumed_ns += dt;
+			if(t->want_ns <= 0)
+				release_task(t, 0);
+		}
+
+		for(i = 0; i < sim->max_task; i++) {
+			struct sim_task *t = &sim->tasks[i];
+			if(t->state == SIM_SLEEPING && t->wake_ns <= sim->now_ns)
+				release_task(t, 0);
+		}
+	}
+}
+
+/* Leave the calling task's code and wait for the simulator to hand control
+ * back. Must be called with sim->lock held and t->state already set. */
+static long sim_wait(struct sim_task *t) {
+	sim->num_outside--;
+	sim_advance();
+
+	while(t->state != SIM_OUTSIDE)
+		pthread_cond_wait(&t->wake, &sim->lock);
+
+	return t->ret;
+}
+
+static long sim_task_register(void) {
+	pthread_condattr_t cattr;
+	cpu_set_t cpus;
+	unsigned long mask = 0;
+	struct sim_task *t;
+	int i, slot = -1;
+
+	if(sim_self >= 0)
+		return 0;
+
+	if(!sched_getaffinity(0, sizeof(cpus), &cpus)) {
+		for(i = 0; i < (int)(sizeof(mask) * 8); i++) {
+			if(CPU_ISSET(i, &cpus))
+				mask |= 1UL << i;
+		}
+	}
+
+	pthread_mutex_lock(&sim->lock);
+
+	for(i = 0; i < SIM_MAX_TASKS; i++) {
+		if(sim->tasks[i].state == SIM_UNUSED) {
+			slot = i;
+			break;
+		}
+	}
+
+	if(slot < 0) {
+		pthread_mutex_unlock(&sim->lock);
+		errno = ENOSPC;
+		return -1;
+	}
+
+	t = &sim->tasks[slot];
+	memset(t, 0, sizeof(struct sim_task));
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&t->wake, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	t->tid = chronos_self_tid();
+	t->state = SIM_OUTSIDE;
+	t->domain = find_domain(mask);
+	if(t->domain < 0)
+		t->domain = add_domain(mask, SCHED_RT_FIFO);
+	if(t->domain < 0) {
+		t->state = SIM_UNUSED;
+		pthread_mutex_unlock(&sim->lock);
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if(slot >= sim->max_task)
+		sim->max_task = slot + 1;
+	sim->num_tasks++;
+	sim->num_outside++;
+	sim_self = slot;
+
+	pthread_mutex_unlock(&sim->lock);
+	return 0;
+}
+
+static long sim_task_unregister(void) {
+	struct sim_task *t;
+
+	if(sim_self < 0)
+		return 0;
+
+	pthread_mutex_lock(&sim->lock);
+	t = &sim->tasks[sim_self];
+	t->state = SIM_UNUSED;
+	pthread_cond_destroy(&t->wake);
+	sim->num_tasks--;
+	sim->num_outside--;
+	while(sim->max_task > 0 &&
+	      sim->tasks[sim->max_task - 1].state == SIM_UNUSED)
+		sim->max_task--;
+	sim_self = -1;
+
+	/* We may have been the last task the others were waiting on */
+	sim_advance();
+	pthread_mutex_unlock(&sim->lock);
+	return 0;
+}
+
+/* Begin t's next job. Must be called with sim->lock held. */
+static void begin_job(struct sim_task *t, struct rt_data *data) {
+	chronos_job_begin(&t->job, data, ++sim->seq);
+	t->consumed_ns = 0;
+	t->aborted = 0;
+	chronos_set_aborted(t->tid, &t->abort_slot, 0, 0);
+}
+
+static long sim_do_rt_seg(int op, struct rt_data *data) {
+	struct sim_task *t;
+	long ret = 0;
+
+	pthread_mutex_lock(&sim->lock);
+	t = find_task(data->tid);
+	if(!t) {
+		pthread_mutex_unlock(&sim->lock);
+		errno = ESRCH;
+		return -1;
+	}
+
+	switch(op) {
+	case RT_SEG_BEGIN:
+		begin_job(t, data);
+		break;
+	case RT_SEG_END:
+		t->job.in_rtseg = 0;
+		t->job.prio = data->prio;
+		break;
+	case RT_SEG_NEXT_JOB:
+		if(data->tid) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		t->job.in_rtseg = 0;
+		if(data->release) {
+			t->wake_ns = timespec_to_ns(data->release);
+			if(t->wake_ns > sim->now_ns) {
+				t->state = SIM_SLEEPING;
+				sim_wait(t);
+			}
+		}
+		begin_job(t, data);
+		break;
+	case RT_SEG_ADD_ABORT:
+		/* HUA handlers are accepted, but aborted jobs simply stop */
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&sim->lock);
+	return ret;
+}
+
+/* Follow the chain of lock owners from m and see if it leads back to t */
+static int would_deadlock(struct sim_task *t, chronos_mutex_t *m) {
+	int hops;
+
+	for(hops = 0; m && hops < SIM_MAX_TASKS; hops++) {
+		struct sim_task *o;
+
+		if(m->owner == t->tid)
+			return 1;
+		o = find_task(m->owner);
+		if(!o || o->state != SIM_BLOCKED)
+			return 0;
+		m = o->blocked_on;
+	}
+	return 0;
+}
+
+/* Hand m straight to the highest priority waiter, or free it. Must be called
+ * with sim->lock held. */
+static void release(chronos_mutex_t *m) {
+	struct sim_task *next = NULL;
+	int i;
+
+	compute_keys();
+	for(i = 0; i < sim->max_task; i++) {
+		struct sim_task *w = &sim->tasks[i];
+		if(w->state == SIM_BLOCKED && w->blocked_on == m &&
+		   (!next || w->key < next->key))
+			next = w;
+	}
+
+	if(next) {
+		m->owner = next->tid;
+		next->blocked_on = NULL;
+		release_task(next, 0);
+	} else {
+		m->value = 0;
+		m->owner = 0;
+	}
+}
+
+/* Take the sorted, distinct locks[0..n) for t, waiting in virtual time for
+ * each one that is held. Before each wait, deadlock is checked for all the
+ * locks still to be taken. On failure the locks taken so far are given back.
+ * Must be called with sim->lock held. */
+static long request(struct sim_task *t, chronos_mutex_t **locks, int n) {
+	int i, j, tid = chronos_self_tid();
+	long ret = 0;
+
+	for(i = 0; i < n; i++) {
+		chronos_mutex_t *m = locks[i];
+
+		if(!m->value) {
+			m->value = 1;
+			m->owner = tid;
+			continue;
+		}
+
+		/* Unregistered threads can't wait in virtual time */
+		ret = m->owner == tid || !t;
+		for(j = i; j < n && !ret; j++)
+			ret = would_deadlock(t, locks[j]);
+		if(ret) {
+			ret = -1;
+			break;
+		}
+
+		t->state = SIM_BLOCKED;
+		t->blocked_on = m;
+		ret = sim_wait(t);	/* only the deadlock breaker fails it */
+		if(ret)
+			break;
+	}
+
+	if(ret) {
+		while(--i >= 0)
+			release(locks[i]);
+		errno = EDEADLK;
+	}
+	return ret;
+}
+
+static long sim_do_chronos_mutex(chronos_mutex_t *m, int op) {
+	struct sim_task *t;
+	int tid = chronos_self_tid();
+	long ret = 0;
+
+	pthread_mutex_lock(&sim->lock);
+	t = find_task(0);
+
+	switch(op) {
+	case CHRONOS_MUTEX_INIT:
+		m->value = 0;
+		m->owner = 0;
+		m->id = (unsigned long)m;
+		break;
+	case CHRONOS_MUTEX_DESTROY:
+		break;
+	case CHRONOS_MUTEX_REQUEST:
+		ret = request(t, &m, 1);
+		break;
+	case CHRONOS_MUTEX_RELEASE:
+		if(!m->value || m->owner != tid) {
+			errno = EPERM;
+			ret = -1;
+			break;
+		}
+		release(m);
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&sim->lock);
+	return ret;
+}
+
+/* Take or release a sorted set of distinct locks under one hold of the
+ * simulator lock */
+static long sim_do_chronos_mutex_set(chronos_mutex_t **locks, int n, int op) {
+	int i, tid = chronos_self_tid();
+	long ret = 0;
+
+	pthread_mutex_lock(&sim->lock);
+
+	switch(op) {
+	case CHRONOS_MUTEX_REQUEST:
+		ret = request(find_task(0), locks, n);
+		break;
+	case CHRONOS_MUTEX_RELEASE:
+		for(i = 0; i < n; i++) {
+			if(!locks[i]->value || locks[i]->owner != tid) {
+				errno = EPERM;
+				ret = -1;
+			}
+		}
+		for(i = n - 1; i >= 0 && !ret; i--)
+			release(locks[i]);
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&sim->lock);
+	return ret;
+}
+
+static long sim_set_scheduler(int scheduler, int prio, unsigned long cpus) {
+	long ret = 0;
+
+	pthread_mutex_lock(&sim->lock);
+	if(add_domain(cpus, scheduler) < 0) {
+		errno = ENOSPC;
+		ret = -1;
+	}
+	pthread_mutex_unlock(&sim->lock);
+	return ret;
+}
+
+/* Every clock reads virtual time */
+static int sim_clock_gettime(clockid_t clk, struct timespec *ts) {
+	pthread_mutex_lock(&sim->lock);
+	ns_to_timespec(sim->now_ns, ts);
+	pthread_mutex_unlock(&sim->lock);
+	return 0;
+}
+
+static int sim_clock_nanosleep(clockid_t clk, int flags,
+			       const struct timespec *req) {
+	struct timespec rel;
+	struct sim_task *t;
+
+	pthread_mutex_lock(&sim->lock);
+	t = find_task(0);
+	if(!t) {
+		/* Not a simulated task, so just sleep for real. An absolute
+		 * time is on the virtual clock, so sleep for as long as that
+		 * is from now instead. */
+		if(flags & TIMER_ABSTIME) {
+			ns_to_timespec(timespec_to_ns(req) - sim->now_ns, &rel);
+			req = &rel;
+		}
+		pthread_mutex_unlock(&sim->lock);
+		if(req->tv_sec < 0 || (!req->tv_sec && req->tv_nsec <= 0))
+			return 0;
+		return chronos_real_nanosleep(CLOCK_MONOTONIC, 0, req);
+	}
+
+	t->wake_ns = timespec_to_ns(req);
+	if(!(flags & TIMER_ABSTIME))
+		t->wake_ns += sim->now_ns;
+
+	if(t->wake_ns > sim->now_ns) {
+		t->state = SIM_SLEEPING;
+		sim_wait(t);
+	}
+
+	pthread_mutex_unlock(&sim->lock);
+	return 0;
+}
+
+long chronos_sim_consume(unsigned long usec) {
+	struct sim_task *t;
+	long ret = 0;
+
+	if(chronos_get_backend() != CHRONOS_BACKEND_SIM) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	pthread_mutex_lock(&sim->lock);
+	t = find_task(0);
+	if(t && t->aborted) {
+		ret = 1;
+	} else if(t && usec) {
+		t->want_ns = (long long)usec * 1000;
+		t->state = SIM_RUNNING;
+		ret = sim_wait(t);
+	}
+	pthread_mutex_unlock(&sim->lock);
+
+	return ret;
+}
+
+struct chronos_backend chronos_sim_backend = {
+	"sim",
+	sim_init,
+	sim_do_rt_seg,
+	sim_do_chronos_mutex,
+	sim_do_chronos_mutex_set,
+	sim_set_scheduler,
+	sim_task_register,
+	sim_task_unregister,
+	sim_clock_gettime,
+	sim_clock_nanosleep,
+	1,
+	CLOCK_MONOTONIC
+};
@@ -0,0 +1,755 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab	   *
+ *									   *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or	   *
+ *   (at your option) any later version.				   *
+ *									   *
+ *   This program is distributed in the hope that it will be useful,	   *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of	   *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the	   *
+ *   GNU General Public License for more details.			   *
+ *									   *
+ *   You should have received a copy of the GNU General Public License	   *
+ *   along with this program; if not, write to the			   *
+ *   Free Software Foundation, Inc.,					   *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
+ ***************************************************************************/
+
+/*
+ * Userspace dispatcher backend. The ChronOS scheduling algorithms are
+ * implemented on top of the stock SCHED_FIFO class: every time a job begins
+ * or ends, or a task blocks on or releases a contended lock, the dispatcher
+ * ranks the jobs on that scheduling domain by the algorithm's key and gives
+ * each task the SCHED_FIFO priority matching its rank. Only the tasks whose
+ * rank actually changed are touched.
+ *
+ * Locks are futexes on chronos_mutex_t.value (0 free, 1 locked, 2 locked
+ * with waiters); a blocked task lends its key to the lock owner when
+ * priority inheritance is enabled.
+ *
+ * The dispatcher state is shared between thread groups, so the backend must
+ * be selected before they are forked.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "chronos.h"
+#include "chronos_backend.h"
+
+#define USER_MAX_TASKS		4096
+#define USER_MAX_DOMAINS	64
+
+/* The lowest SCHED_FIFO priority a ranked job is given. Only the jobs which
+ * rank above every other get a priority of their own, one for each priority
+ * between the highest task priority and this one; the rest all wait here. */
+#define USER_MIN_PRIO		1
+
+struct user_domain {
+	unsigned long mask;
+	int scheduler;
+	int parked;		/* ready jobs left at USER_MIN_PRIO by the last dispatch */
+};
+
+struct user_task {
+	int tid;
+	int used;
+	int domain;
+	struct chronos_job job;
+	chronos_mutex_t *blocked_on;
+	int cur_prio;		/* the SCHED_FIFO priority it has now */
+	int aborted;		/* its current job has been aborted */
+	struct chronos_abort_slot *abort_slot;
+	long long key;
+};
+
+struct user_state {
+	pthread_mutex_t lock;
+	unsigned long seq;
+	int max_task;
+	int num_domains;
+	struct user_domain domains[USER_MAX_DOMAINS];
+	struct user_task tasks[USER_MAX_TASKS];
+
+	struct chronos_dispatch_stats stats;
+};
+
+static struct user_state *user = NULL;
+static __thread int user_self = -1;
+
+/* While it holds user->lock, a thread which dispatches runs above every task
+ * so the first task it raises doesn't preempt it. It only drops back to its
+ * own priority once it has released the lock again. */
+static __thread int user_boosted = 0;
+static __thread int user_saved_policy;
+static __thread struct sched_param user_saved_param;
+
+static inline long long now_ns(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_ns(&now);
+}
+
+static inline long futex(u_int32_t *addr, int op, u_int32_t val) {
+	return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static int user_init(void) {
+	pthread_mutexattr_t mattr;
+
+	if(user)
+		return 0;
+
+	user = (struct user_state *) mmap(NULL, sizeof(struct user_state),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(user == MAP_FAILED) {
+		user = NULL;
+		return -1;
+	}
+
+	/* The dispatcher runs at the callers' real-time priorities, so its own
+	 * lock must not invert them */
+	memset(user, 0, sizeof(struct user_state));
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&user->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	return 0;
+}
+
+static int find_domain(unsigned long mask) {
+	int i;
+
+	for(i = 0; i < user->num_domains; i++) {
+		if(user->domains[i].mask == mask)
+			return i;
+	}
+
+	for(i = 0; i < user->num_domains; i++) {
+		if(user->domains[i].mask & mask)
+			return i;
+	}
+	return -1;
+}
+
+static int add_domain(unsigned long mask, int scheduler) {
+	int d = find_domain(mask);
+
+	if(d < 0 || user->domains[d].mask != mask) {
+		if(user->num_domains == USER_MAX_DOMAINS)
+			return -1;
+		d = user->num_domains++;
+	}
+
+	user->domains[d].mask = mask;
+	user->domains[d].scheduler = scheduler;
+	return d;
+}
+
+static struct user_task *find_task(int tid) {
+	int i;
+
+	if(!tid || tid == chronos_self_tid())
+		return user_self >= 0 ? &user->tasks[user_self] : NULL;
+
+	for(i = 0; i < user->max_task; i++) {
+		if(user->tasks[i].used && user->tasks[i].tid == tid)
+			return &user->tasks[i];
+	}
+	return NULL;
+}
+
+/* The task holding m. The owner is 0 while the lock is being released, and
+ * between a fast-path acquisition and its owner being stored; nobody is
+ * taken to hold it then (find_task would take 0 for the calling task). */
+static struct user_task *find_owner(chronos_mutex_t *m) {
+	int owner = m->owner;
+
+	return owner ? find_task(owner) : NULL;
+}
+
+static int set_fifo_prio(struct user_task *t, int prio) {
+	struct sched_param param;
+
+	if(t->cur_prio == prio)
+		return 0;
+
+	/* A boosted thread takes its new priority when it releases the lock */
+	if(user_boosted && t == &user->tasks[user_self]) {
+		t->cur_prio = prio;
+		return 0;
+	}
+
+	param.sched_priority = prio;
+	if(sched_setscheduler(t->tid, SCHED_FIFO, &param))
+		return -1;
+
+	t->cur_prio = prio;
+	user->stats.prio_changes++;
+	return 0;
+}
+
+static void user_lock(void) {
+	pthread_mutex_lock(&user->lock);
+}
+
+static void boost(void) {
+	struct sched_param param;
+
+	if(user_boosted)
+		return;
+
+	user_saved_policy = sched_getscheduler(0);
+	sched_getparam(0, &user_saved_param);
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	sched_setscheduler(0, SCHED_FIFO, &param);
+	user_boosted = 1;
+}
+
+static void user_unlock(void) {
+	struct sched_param param = user_saved_param;
+	int policy = user_saved_policy;
+
+	if(!user_boosted) {
+		pthread_mutex_unlock(&user->lock);
+		return;
+	}
+
+	if(user_self >= 0 && user->tasks[user_self].cur_prio > 0) {
+		policy = SCHED_FIFO;
+		param.sched_priority = user->tasks[user_self].cur_prio;
+	}
+	user_boosted = 0;
+	pthread_mutex_unlock(&user->lock);
+	sched_setscheduler(0, policy, &param);
+}
+
+/* Re-rank the jobs on domain d and remap their SCHED_FIFO priorities. Must be
+ * called with user->lock held. */
+static void dispatch(int d) {
+	static int order[USER_MAX_TASKS];
+	static char ranked[USER_MAX_TASKS];
+	int i, j, n = 0, levels, base = 0, pass, changed;
+	long long start = now_ns(), elapsed;
+
+	boost();
+
+	/* HVDF drops jobs which have already missed their deadline; the job
+	 * stops itself once it sees its abort byte (or signal) */
+	if((user->domains[d].scheduler & ~SCHED_FLAGS_MASK) == SCHED_RT_HVDF) {
+		for(i = 0; i < user->max_task; i++) {
+			struct user_task *t = &user->tasks[i];
+
+			if(!t->used || t->domain != d || !t->job.in_rtseg ||
+			   t->aborted || start <= t->job.deadline_ns)
+				continue;
+			t->aborted = 1;
+			chronos_set_aborted(t->tid, &t->abort_slot, 1,
+					    now_ns());
+		}
+	}
+
+	for(i = 0; i < user->max_task; i++) {
+		struct user_task *t = &user->tasks[i];
+
+		if(!t->used)
+			continue;
+		t->key = chronos_job_key(user->domains[t->domain].scheduler,
+					 &t->job);
+
+		/* An aborted job runs first, just long enough to notice */
+		if(t->aborted && t->job.in_rtseg)
+			t->key = LLONG_MIN;
+	}
+
+	/* Lock owners inherit the keys of the tasks waiting on them */
+	for(pass = 0, changed = 1; changed && pass < 16; pass++) {
+		changed = 0;
+		for(i = 0; i < user->max_task; i++) {
+			struct user_task *w = &user->tasks[i], *o;
+
+			if(!w->used || !w->blocked_on)
+				continue;
+			o = find_owner(w->blocked_on);
+			if(!o || !(user->domains[o->domain].scheduler & SCHED_FLAG_PI))
+				continue;
+			if(w->key < o->key) {
+				o->key = w->key;
+				changed = 1;
+			}
+		}
+	}
+
+	for(i = 0; i < user->max_task; i++) {
+		struct user_task *t = &user->tasks[i];
+
+		if(t->used && t->domain == d && t->key != CHRONOS_KEY_IDLE &&
+		   t->job.prio > base)
+			base = t->job.prio;
+	}
+	levels = base > USER_MIN_PRIO ? base - USER_MIN_PRIO : 0;
+
+	/* Insertion sort the best jobs on this domain by key, as many as there
+	 * are priorities above USER_MIN_PRIO, so that a dispatch costs O(levels)
+	 * per job and changes at most levels + 1 priorities however many jobs
+	 * the domain has */
+	for(i = 0; i < user->max_task; i++) {
+		struct user_task *t = &user->tasks[i];
+
+		if(!t->used || t->domain != d || t->key == CHRONOS_KEY_IDLE)
+			continue;
+		if(n == levels &&
+		   (!n || user->tasks[order[n - 1]].key <= t->key))
+			continue;
+
+		if(n < levels)
+			n++;
+		for(j = n - 1; j > 0 && user->tasks[order[j - 1]].key > t->key; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	memset(ranked, 0, user->max_task);
+	for(i = 0; i < n; i++) {
+		ranked[order[i]] = 1;
+		set_fifo_prio(&user->tasks[order[i]], base - i);
+	}
+
+	user->domains[d].parked = 0;
+	for(i = 0; i < user->max_task; i++) {
+		struct user_task *t = &user->tasks[i];
+
+		if(t->used && t->domain == d && t->key != CHRONOS_KEY_IDLE &&
+		   !ranked[i]) {
+			set_fifo_prio(t, USER_MIN_PRIO);
+			user->domains[d].parked++;
+		}
+	}
+
+	elapsed = now_ns() - start;
+	user->stats.events++;
+	user->stats.total_ns += elapsed;
+	if((unsigned long long)elapsed > user->stats.max_ns)
+		user->stats.max_ns = elapsed;
+
+}
+
+static struct user_task *add_task(int tid) {
+	cpu_set_t cpus;
+	unsigned long mask = 0;
+	struct user_task *t;
+	int i, slot = -1;
+
+	for(i = 0; i < USER_MAX_TASKS; i++) {
+		if(!user->tasks[i].used) {
+			slot = i;
+			break;
+		}
+	}
+	if(slot < 0)
+		return NULL;
+
+	if(!sched_getaffinity(tid, sizeof(cpus), &cpus)) {
+		for(i = 0; i < (int)(sizeof(mask) * 8); i++) {
+			if(CPU_ISSET(i, &cpus))
+				mask |= 1UL << i;
+		}
+	}
+
+	t = &user->tasks[slot];
+	memset(t, 0, sizeof(struct user_task));
+	t->tid = tid;
+	t->domain = find_domain(mask);
+	if(t->domain < 0)
+		t->domain = add_domain(mask, SCHED_RT_FIFO);
+	if(t->domain < 0)
+		return NULL;
+	t->cur_prio = -1;
+	t->used = 1;
+
+	if(slot >= user->max_task)
+		user->max_task = slot + 1;
+	return t;
+}
+
+static long user_task_register(void) {
+	struct user_task *t;
+
+	if(user_self >= 0)
+		return 0;
+
+	user_lock();
+	t = add_task(chronos_self_tid());
+	if(t)
+		user_self = t - user->tasks;
+	user_unlock();
+
+	if(!t) {
+		errno = ENOSPC;
+		return -1;
+	}
+	return 0;
+}
+
+static long user_task_unregister(void) {
+	struct user_task *t;
+	int d;
+
+	if(user_self < 0)
+		return 0;
+
+	user_lock();
+	t = &user->tasks[user_self];
+	d = t->domain;
+	t->used = 0;
+	while(user->max_task > 0 && !user->tasks[user->max_task - 1].used)
+		user->max_task--;
+	user_self = -1;
+	dispatch(d);
+	user_unlock();
+	return 0;
+}
+
+/* Begin t's next job. Must be called with user->lock held. */
+static void begin_job(struct user_task *t, struct rt_data *data) {
+	chronos_job_begin(&t->job, data, ++user->seq);
+	chronos_set_aborted(t->tid, &t->abort_slot, 0, 0);
+	t->aborted = 0;
+
+	/* HVDF drops jobs which can't make their deadline at all */
+	if((user->domains[t->domain].scheduler & ~SCHED_FLAGS_MASK) ==
+	   SCHED_RT_HVDF &&
+	   now_ns() + t->job.exec_ns > t->job.deadline_ns) {
+		t->aborted = 1;
+		chronos_set_aborted(t->tid, &t->abort_slot, 1, now_ns());
+	}
+
+	dispatch(t->domain);
+}
+
+static long user_do_rt_seg(int op, struct rt_data *data) {
+	struct user_task *t;
+	long ret = 0;
+
+	/* A task is registered implicitly by its first real-time segment */
+	if(!data->tid && user_self < 0 && user_task_register())
+		return -1;
+
+	user_lock();
+	t = find_task(data->tid);
+	if(!t) {
+		user_unlock();
+		errno = ESRCH;
+		return -1;
+	}
+
+	switch(op) {
+	case RT_SEG_BEGIN:
+		begin_job(t, data);
+		break;
+	case RT_SEG_END:
+		t->job.in_rtseg = 0;
+		t->job.prio = data->prio;
+		dispatch(t->domain);
+		set_fifo_prio(t, data->prio);
+		break;
+	case RT_SEG_NEXT_JOB:
+		if(data->tid) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+
+		/* The task keeps its priority while it sleeps, where it
+		 * doesn't matter, so the job can end without a dispatch:
+		 * the others are still ranked in order, unless one of them
+		 * is parked waiting for the rank this job leaves */
+		t->job.in_rtseg = 0;
+		if(user->domains[t->domain].parked)
+			dispatch(t->domain);
+		user_unlock();
+
+		if(data->release &&
+		   chronos_clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					   data->release))
+			return -1;
+
+		user_lock();
+		begin_job(t, data);
+		break;
+	case RT_SEG_ADD_ABORT:
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+	}
+
+	user_unlock();
+	return ret;
+}
+
+static int would_deadlock(struct user_task *t, chronos_mutex_t *m) {
+	int hops;
+
+	for(hops = 0; m && hops < USER_MAX_TASKS; hops++) {
+		struct user_task *o;
+
+		if(m->owner == t->tid)
+			return 1;
+		o = find_owner(m);
+		if(!o)
+			return 0;
+		m = o->blocked_on;
+	}
+	return 0;
+}
+
+/* Record that we're about to block on m, and let the owner inherit from us.
+ * Returns -1 if blocking would deadlock and deadlock prevention is on. */
+static int user_block(chronos_mutex_t *m) {
+	struct user_task *t;
+	int ret = 0;
+
+	user_lock();
+	t = find_task(0);
+	if(t) {
+		if((user->domains[t->domain].scheduler & SCHED_FLAG_NO_DEADLOCKS)
+		   && would_deadlock(t, m)) {
+			ret = -1;
+		} else {
+			t->blocked_on = m;
+			dispatch(t->domain);
+		}
+	}
+	user_unlock();
+	return ret;
+}
+
+/* Like user_block, for the first lock of locks[0..n) that is held by someone
+ * else: deadlock prevention looks at every lock still to be taken at once.
+ * Blocking moves straight from any lock the task waited on before. */
+static int user_block_set(chronos_mutex_t **locks, int n) {
+	struct user_task *t;
+	int i, ret = 0;
+
+	user_lock();
+	t = find_task(0);
+	if(t) {
+		if(user->domains[t->domain].scheduler & SCHED_FLAG_NO_DEADLOCKS) {
+			for(i = 0; i < n && !ret; i++)
+				ret = would_deadlock(t, locks[i]) ? -1 : 0;
+		}
+		if(!ret) {
+			t->blocked_on = locks[0];
+			dispatch(t->domain);
+		}
+	}
+	user_unlock();
+	return ret;
+}
+
+/* Stop counting as blocked without re-ranking the domain, while there are
+ * more locks of a set to take */
+static void user_unblock_quiet(void) {
+	user_lock();
+	if(user_self >= 0)
+		user->tasks[user_self].blocked_on = NULL;
+	user_unlock();
+}
+
+static void user_unblock(void) {
+	struct user_task *t;
+
+	user_lock();
+	t = find_task(0);
+	if(t) {
+		t->blocked_on = NULL;
+		dispatch(t->domain);
+	}
+	user_unlock();
+}
+
+/* Wait for a lock which was found held, c being the value last seen */
+static void take_contended(chronos_mutex_t *m, u_int32_t c) {
+	do {
+		if(c == 2 || __sync_val_compare_and_swap(&m->value, 1, 2))
+			futex(&m->value, FUTEX_WAIT, 2);
+	} while((c = __sync_val_compare_and_swap(&m->value, 0, 2)));
+}
+
+/* Release a lock we hold. Returns 1 if a waiter was woken. */
+static int release(chronos_mutex_t *m) {
+	m->owner = 0;
+	if(__sync_fetch_and_sub(&m->value, 1) == 1)
+		return 0;
+
+	m->value = 0;
+	futex(&m->value, FUTEX_WAKE, 1);
+	return 1;
+}
+
+/* Re-rank the caller's domain once it no longer inherits from a waiter */
+static void redispatch(void) {
+	user_lock();
+	if(user_self >= 0)
+		dispatch(user->tasks[user_self].domain);
+	user_unlock();
+}
+
+static long user_do_chronos_mutex(chronos_mutex_t *m, int op) {
+	u_int32_t c;
+	int tid = chronos_self_tid();
+
+	switch(op) {
+	case CHRONOS_MUTEX_INIT:
+		m->value = 0;
+		m->owner = 0;
+		m->id = (unsigned long)m;
+		return 0;
+	case CHRONOS_MUTEX_DESTROY:
+		return 0;
+	case CHRONOS_MUTEX_REQUEST:
+		c = __sync_val_compare_and_swap(&m->value, 0, 1);
+		if(!c) {
+			m->owner = tid;
+			return 0;
+		}
+
+		if(m->owner == tid || user_block(m)) {
+			errno = EDEADLK;
+			return -1;
+		}
+
+		take_contended(m, c);
+		m->owner = tid;
+		user_unblock();
+		return 0;
+	case CHRONOS_MUTEX_RELEASE:
+		if(m->owner != tid) {
+			errno = EPERM;
+			return -1;
+		}
+
+		/* Give back anything we inherited */
+		if(release(m))
+			redispatch();
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/* Take or release a sorted set of distinct locks. The uncontended locks cost
+ * nothing more than their own compare-and-swap: the dispatcher only runs when
+ * the task has to wait, and once more when it has the whole set, and a
+ * release re-ranks the domain once for all the locks that had waiters. */
+static long user_do_chronos_mutex_set(chronos_mutex_t **locks, int n, int op) {
+	int i, tid = chronos_self_tid(), blocked = 0, woke = 0;
+	u_int32_t c;
+
+	switch(op) {
+	case CHRONOS_MUTEX_REQUEST:
+		for(i = 0; i < n; i++) {
+			c = __sync_val_compare_and_swap(&locks[i]->value, 0, 1);
+			if(!c) {
+				locks[i]->owner = tid;
+				continue;
+			}
+
+			if(locks[i]->owner == tid ||
+			   user_block_set(&locks[i], n - i)) {
+				/* Give back what we have so far */
+				while(--i >= 0)
+					woke |= release(locks[i]);
+				if(blocked || woke)
+					user_unblock();
+				errno = EDEADLK;
+				return -1;
+			}
+
+			take_contended(locks[i], c);
+			locks[i]->owner = tid;
+			blocked = 1;
+			if(i < n - 1)
+				user_unblock_quiet();
+		}
+		if(blocked)
+			user_unblock();
+		return 0;
+	case CHRONOS_MUTEX_RELEASE:
+		for(i = 0; i < n; i++) {
+			if(locks[i]->owner != tid) {
+				errno = EPERM;
+				return -1;
+			}
+		}
+
+		for(i = n - 1; i >= 0; i--)
+			woke |= release(locks[i]);
+		if(woke)
+			redispatch();
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static long user_set_scheduler(int scheduler, int prio, unsigned long cpus) {
+	long ret = 0;
+
+	user_lock();
+	if(add_domain(cpus, scheduler) < 0) {
+		errno = ENOSPC;
+		ret = -1;
+	}
+	user_unlock();
+	return ret;
+}
+
+int chronos_get_dispatch_stats(struct chronos_dispatch_stats *stats) {
+	if(chronos_get_backend() != CHRONOS_BACKEND_USER) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	user_lock();
+	*stats = user->stats;
+	user_unlock();
+	return 0;
+}
+
+void chronos_reset_dispatch_stats(void) {
+	if(chronos_get_backend() != CHRONOS_BACKEND_USER)
+		return;
+
+	user_lock();
+	memset(&user->stats, 0, sizeof(user->stats));
+	user_unlock();
+}
+
+struct chronos_backend chronos_user_backend = {
+	"user",
+	user_init,
+	user_do_rt_seg,
+	user_do_chronos_mutex,
+	user_do_chronos_mutex_set,
+	user_set_scheduler,
+	user_task_register,
+	user_task_unregister,
+	NULL,
+	NULL,
+	1,
+	CLOCK_MONOTONIC
+};
@@ -19,9 +19,12 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.		   *
  ***************************************************************************/
 
+#include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include "chronos_utils.h"
 
 int deadline_met(struct timespec *end_time, struct timespec *deadline) {
@@ -44,6 +47,183 @@ unsigned long subtract_ts(struct timespec *first, struct timespec *last) {
 	return time;
 }
 
+/* Periodic threads. Each one has a timerfd, which the dispatcher thread
+ * waits on along with all the others, and a worker thread which stays alive
+ * between releases, so a release costs a wakeup rather than a thread. */
+
+#define PERIODIC_MAX_EVENTS	64
+
+struct periodic_thread {
+	int tfd;
+	pthread_t worker;
+	void (*func)(union sigval);
+	void *arg;
+	long long start_ns;
+	long long period_ns;
+
+	/* Protected by lock */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long long expirations;	/* timer expirations so far */
+	long long release_ns;	/* instant of the latest of them */
+	int pending;		/* a release the worker hasn't started on yet */
+	int running;		/* the worker is in func */
+	int quit;
+	int exited;
+	int self_deleted;	/* the worker frees us once func returns */
+	struct periodic_thread_stats stats;
+
+	struct periodic_thread *next;	/* on periodic_list */
+};
+
+/* The dispatcher only touches the periodic threads on the list, under
+ * periodic_lock, so one deleted after epoll_wait returned is skipped */
+static pthread_mutex_t periodic_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct periodic_thread *periodic_list = NULL;
+static int periodic_epfd = -1;
+
+static inline long long ts_to_ns(struct timespec *ts) {
+	return (long long)ts->tv_sec * BILLION + ts->tv_nsec;
+}
+
+static int periodic_listed(struct periodic_thread *p) {
+	struct periodic_thread *curr;
+
+	for(curr = periodic_list; curr; curr = curr->next)
+		if(curr == p)
+			return 1;
+	return 0;
+}
+
+/* Hand count expirations of the timer over to the worker. Only the latest
+ * one is run; the rest, and any which come while func is running, are
+ * overruns. */
+static void periodic_release(struct periodic_thread *p, uint64_t count) {
+	pthread_mutex_lock(&p->lock);
+	p->expirations += count;
+	p->release_ns = p->start_ns + (p->expirations - 1) * p->period_ns;
+	p->stats.overruns += p->pending || p->running ? count : count - 1;
+	p->pending = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void *periodic_dispatch(void *unused) {
+	struct epoll_event events[PERIODIC_MAX_EVENTS];
+	int i, n;
+
+	for(;;) {
+		n = epoll_wait(periodic_epfd, events, PERIODIC_MAX_EVENTS, -1);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("epoll_wait fails");
+			return NULL;
+		}
+
+		pthread_mutex_lock(&periodic_lock);
+		for(i = 0; i < n; i++) {
+			struct periodic_thread *p =
+				(struct periodic_thread *)events[i].data.ptr;
+			uint64_t count;
+
+			if(!periodic_listed(p))
+				continue;
+			if(read(p->tfd, &count, sizeof(count)) != sizeof(count))
+				continue;
+			periodic_release(p, count);
+		}
+		pthread_mutex_unlock(&periodic_lock);
+	}
+}
+
+static void *periodic_work(void *arg) {
+	struct periodic_thread *p = (struct periodic_thread *)arg;
+	union sigval value;
+	struct timespec now;
+	long long latency;
+
+	value.sival_ptr = p->arg;
+
+	pthread_mutex_lock(&p->lock);
+	for(;;) {
+		while(!p->pending && !p->quit)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if(p->quit)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		latency = ts_to_ns(&now) - p->release_ns;
+		if(latency < 0)
+			latency = 0;
+		p->stats.releases++;
+		p->stats.total_latency_ns += latency;
+		if((unsigned long long)latency > p->stats.max_latency_ns)
+			p->stats.max_latency_ns = latency;
+
+		p->pending = 0;
+		p->running = 1;
+		pthread_mutex_unlock(&p->lock);
+		p->func(value);
+		pthread_mutex_lock(&p->lock);
+		p->running = 0;
+	}
+
+	if(p->self_deleted) {
+		pthread_mutex_unlock(&p->lock);
+		pthread_cond_destroy(&p->cond);
+		pthread_mutex_destroy(&p->lock);
+		free(p);
+		return NULL;
+	}
+
+	p->exited = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/* Start the dispatcher with the first periodic thread. It then stays
+ * around for the life of the process. It runs at the highest SCHED_FIFO
+ * priority, whatever the workers run at, so that a release never waits behind
+ * a worker; without the privileges for that it runs at the default. */
+static int periodic_start_dispatcher(void) {
+	struct sched_param param;
+	pthread_attr_t attr;
+	pthread_t dispatcher;
+	int ret;
+
+	if(periodic_epfd >= 0)
+		return 0;
+
+	periodic_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(periodic_epfd < 0)
+		return -1;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	ret = pthread_create(&dispatcher, &attr, periodic_dispatch, NULL);
+	if(ret == EPERM) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		ret = pthread_create(&dispatcher, &attr, periodic_dispatch,
+				     NULL);
+	}
+	pthread_attr_destroy(&attr);
+	if(ret) {
+		close(periodic_epfd);
+		periodic_epfd = -1;
+		errno = ret;
+		return -1;
+	}
+
+	return 0;
+}
+
 /* Make a periodic thread */
 timer_t * make_periodic_threads(timer_t *timer,
 				     void (*func)(union sigval),
@@ -51,33 +231,133 @@ timer_t * make_periodic_threads(timer_t *timer,
 				     struct timespec start_time,
 				     struct timespec period,
 				     pthread_attr_t *tattr) {
-	struct sigevent event;
-	struct itimerspec new_value, old_value;
+	struct periodic_thread *p;
+	struct itimerspec new_value;
+	struct epoll_event event;
+	int ret, detach = PTHREAD_CREATE_JOINABLE;
 
-	/* create a timer */
-	event.sigev_notify_function = func;
-	event.sigev_value.sival_ptr = arg;
-	event.sigev_notify = SIGEV_THREAD;
-	event.sigev_notify_attributes = tattr;
+	p = (struct periodic_thread *)calloc(1, sizeof(struct periodic_thread));
+	if(!p) {
+		perror("allocating periodic thread fails");
+		return NULL;
+	}
+	p->func = func;
+	p->arg = arg;
+	p->start_ns = ts_to_ns(&start_time);
+	p->period_ns = ts_to_ns(&period);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
 
-	if(timer_create(CLOCK_REALTIME, &event, timer) < 0) {
+	/* create a timer */
+	p->tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(p->tfd < 0) {
 		perror("creating timer fails");
-		return NULL;
+		goto out_free;
+	}
+
+	ret = pthread_create(&p->worker, tattr, periodic_work, p);
+	if(ret) {
+		errno = ret;
+		perror("creating periodic thread fails");
+		goto out_close;
 	}
 
+	/* Nobody joins the worker; delete_periodic_thread waits for exited */
+	if(tattr)
+		pthread_attr_getdetachstate(tattr, &detach);
+	if(detach == PTHREAD_CREATE_JOINABLE)
+		pthread_detach(p->worker);
+
+	pthread_mutex_lock(&periodic_lock);
+	if(periodic_start_dispatcher()) {
+		pthread_mutex_unlock(&periodic_lock);
+		perror("creating periodic dispatcher fails");
+		goto out_stop;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = p;
+	if(epoll_ctl(periodic_epfd, EPOLL_CTL_ADD, p->tfd, &event) < 0) {
+		pthread_mutex_unlock(&periodic_lock);
+		perror("watching timer fails");
+		goto out_stop;
+	}
+	p->next = periodic_list;
+	periodic_list = p;
+	pthread_mutex_unlock(&periodic_lock);
+
 	/* start the timer */
 	memcpy(&new_value.it_value, &start_time, sizeof(struct timespec));
 	memcpy(&new_value.it_interval, &period, sizeof(struct timespec));
 
-	if(timer_settime(*timer, TIMER_ABSTIME, &new_value, &old_value) < 0) {
+	if(timerfd_settime(p->tfd, TFD_TIMER_ABSTIME, &new_value, NULL) < 0) {
 		perror("timer_settime fails");
+		delete_periodic_thread((timer_t)p);
 		return NULL;
 	}
 
+	*timer = (timer_t)p;
 	return timer;
+
+out_stop:
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->cond);
+	while(!p->exited)
+		pthread_cond_wait(&p->cond, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+out_close:
+	close(p->tfd);
+out_free:
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	return NULL;
 }
 
 int delete_periodic_thread(timer_t timer) {
-	return timer_delete(timer);
+	struct periodic_thread *p = (struct periodic_thread *)timer;
+	struct periodic_thread **curr;
+
+	pthread_mutex_lock(&periodic_lock);
+	for(curr = &periodic_list; *curr && *curr != p; curr = &(*curr)->next)
+		;
+	if(!*curr) {
+		pthread_mutex_unlock(&periodic_lock);
+		errno = EINVAL;
+		return -1;
+	}
+	*curr = p->next;
+	epoll_ctl(periodic_epfd, EPOLL_CTL_DEL, p->tfd, NULL);
+	close(p->tfd);
+	pthread_mutex_unlock(&periodic_lock);
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->cond);
+
+	/* From inside func, the worker cleans up after itself once it returns */
+	if(p->running && pthread_equal(pthread_self(), p->worker)) {
+		p->self_deleted = 1;
+		pthread_mutex_unlock(&p->lock);
+		return 0;
+	}
+
+	while(!p->exited)
+		pthread_cond_wait(&p->cond, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	return 0;
 }
 
+int get_periodic_thread_stats(timer_t timer, struct periodic_thread_stats *stats) {
+	struct periodic_thread *p = (struct periodic_thread *)timer;
+
+	pthread_mutex_lock(&p->lock);
+	memcpy(stats, &p->stats, sizeof(struct periodic_thread_stats));
+	pthread_mutex_unlock(&p->lock);
+	return 0;
+}
@@ -22,6 +22,7 @@
 #ifndef CHRONOS_UTILS_H
 #define CHRONOS_UTILS_H
 
+#include <pthread.h>
 #include <string.h>
 #include <signal.h>
 #include <stdint.h>
@@ -63,7 +64,13 @@ int deadline_met(struct timespec *end_time, struct timespec *deadline);
 
 unsigned long subtract_ts(struct timespec *first, struct timespec *last);
 
-/* Make periodic threads */
+/* Make periodic threads. func is called with arg at start_time (on
+ * CLOCK_REALTIME) and every period after it, always on the same worker thread,
+ * which is created with tattr (if given). One dispatcher thread, at the
+ * highest SCHED_FIFO priority, waits on the timers of every periodic thread
+ * and hands their releases over. A release which comes while the last call is
+ * still running is counted as an overrun, and the worker runs func once more
+ * when it is done rather than once for each release it missed. */
 timer_t * make_periodic_threads(timer_t *timer,
 				     void (*func)(union sigval),
 				     void *arg,
@@ -71,8 +78,20 @@ timer_t * make_periodic_threads(timer_t *timer,
 				     struct timespec period,
 				     pthread_attr_t *tattr);
 
+/* Stop a periodic thread, waiting for a call in progress to return unless it
+ * is the periodic thread deleting itself */
 int delete_periodic_thread(timer_t timer);
 
+struct periodic_thread_stats {
+	unsigned long long releases;	/* calls of func */
+	unsigned long long overruns;	/* releases which came during a call */
+	unsigned long long total_latency_ns;	/* release instant to call */
+	unsigned long long max_latency_ns;
+};
+
+/* Read the release statistics of a periodic thread so far */
+int get_periodic_thread_stats(timer_t timer, struct periodic_thread_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,91 @@
+#include <sys/types.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+/* Link against local copies, NOT outdated or non-existent ones */
+#include "chronos_utils.h"
+
+/* Measure the release latency of periodic threads: start threads periodic
+ * threads with periods of 1, 2, 3... msec, each at a SCHED_FIFO priority one
+ * lower than the last (or at the default priority without the privileges for
+ * that), run them for seconds and report how late each was released, on
+ * average and at worst, and how many releases it overran. */
+
+#define DEFAULT_THREADS		4
+#define DEFAULT_SECONDS		2
+#define PERIODIC_BENCH_PRIO	80
+
+static void tick(union sigval value)
+{
+	(void)value;
+}
+
+int main(int argc, char* argv[])
+{
+	struct periodic_thread_stats stats;
+	struct sched_param param;
+	struct timespec start, period;
+	pthread_attr_t attr;
+	timer_t *timers;
+	int threads, seconds, i, failed = 0;
+
+	threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+	seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+	if(threads <= 0 || threads > PERIODIC_BENCH_PRIO || seconds <= 0) {
+		fprintf(stderr, "Usage: %s [threads [seconds]]\n", argv[0]);
+		exit(1);
+	}
+
+	timers = (timer_t *)calloc(threads, sizeof(timer_t));
+	if(!timers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &start);
+	start.tv_sec++;
+
+	for(i = 0; i < threads; i++) {
+		period.tv_sec = 0;
+		period.tv_nsec = (i + 1) * MILLION;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = PERIODIC_BENCH_PRIO - i;
+		pthread_attr_setschedparam(&attr, &param);
+
+		if(!make_periodic_threads(&timers[i], tick, NULL, start, period,
+					  &attr) &&
+		   !make_periodic_threads(&timers[i], tick, NULL, start, period,
+					  NULL)) {
+			fprintf(stderr, "thread %d: can't be made\n", i);
+			exit(1);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	sleep(seconds + 1);
+
+	for(i = 0; i < threads; i++) {
+		get_periodic_thread_stats(timers[i], &stats);
+		delete_periodic_thread(timers[i]);
+
+		printf("thread %d (%d msec): %llu releases, %llu overruns, "
+		       "latency avg %llu nsec, max %llu nsec\n", i, i + 1,
+		       stats.releases, stats.overruns,
+		       stats.releases ? stats.total_latency_ns / stats.releases : 0,
+		       stats.max_latency_ns);
+
+		/* every period should have been released, late or not */
+		if(stats.releases + stats.overruns <
+		   (unsigned long long)seconds * THOUSAND / (i + 1))
+			failed = 1;
+	}
+
+	free(timers);
+	if(failed)
+		fprintf(stderr, "some releases went missing\n");
+	return failed;
+}
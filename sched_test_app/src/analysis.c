@@ -0,0 +1,579 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Offline schedulability analysis of a taskset, printed by the -z flag instead
+ * of running it. Every task has an implicit deadline (its period), and the
+ * tasks of a scheduling domain are analysed together:
+ *  - RMA: exact response-time analysis on one CPU, and the response-time
+ *    bound of Bertogna and Cirinei for global scheduling on several.
+ *  - EDF: the processor-demand test with Zhang and Burns' QPA and Spuri's
+ *    response times on one CPU; the GFB utilization bound and the
+ *    Bertogna-Cirinei EDF response-time bound on several.
+ * Blocking is one critical section of a lower-priority task which shares a
+ * lock with the task or a higher-priority one, as with priority ceilings or
+ * SRP. Priority inheritance alone can block a task for longer.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "analysis.h"
+#include "sched_algorithms.h"
+#include "utils.h"
+
+//give up on a fixed-point iteration after this many steps
+#define MAX_STEPS		1000000
+
+//response times which are not a number of microseconds
+#define RESPONSE_MISS		LLONG_MAX	//exceeds the deadline
+#define RESPONSE_UNKNOWN	-1	//gave up before finding it
+
+//the highest CPU usage the command line accepts
+#define MAX_USAGE		10000
+
+/*
+ * A task as the analysis sees it, at one particular CPU usage. All times are in
+ * microseconds.
+ */
+struct an_task {
+	int index;		//position in the taskset file, from 0
+	struct task *t;
+	long long C;		//execution time
+	long long T;		//period, which is also the relative deadline
+	long long cs;		//length of one critical section
+	long long B;		//worst-case blocking
+	long long R;		//worst-case response time
+};
+
+/*
+ * The kinds of scheduler the analysis knows about.
+ */
+#define ANALYSIS_NONE	0
+#define ANALYSIS_RM	1
+#define ANALYSIS_EDF	2
+
+static int analysis_kind(int scheduler)
+{
+	switch (scheduler & ~SCHED_FLAGS_MASK) {
+	case SCHED_RT_RMA:
+	case SCHED_RT_RMA_ICPP:
+	case SCHED_RT_RMA_OCPP:
+	case SCHED_RT_GRMA:
+		return ANALYSIS_RM;
+	case SCHED_RT_EDF:
+		return ANALYSIS_EDF;
+	default:
+		return ANALYSIS_NONE;
+	}
+}
+
+static inline long long div_ceil(long long a, long long b)
+{
+	return (a + b - 1) / b;
+}
+
+static inline long long min_ll(long long a, long long b)
+{
+	return a < b ? a : b;
+}
+
+/*
+ * Return true if the two tasks use at least one lock in common.
+ */
+static int shares_lock(struct task *a, struct task *b)
+{
+	int i, j;
+
+	for (i = 0; i < a->num_my_locks; i++)
+		for (j = 0; j < b->num_my_locks; j++)
+			if (a->my_locks[i] == b->my_locks[j])
+				return 1;
+	return 0;
+}
+
+/*
+ * Fill ts[] with the tasks of the domain given by mask at the given CPU usage,
+ * ordered by period (which is priority order for RMA and deadline order for
+ * EDF), and work out their blocking. Returns the number of tasks.
+ */
+static int domain_tasks(struct test *tester, unsigned long mask, int usage,
+			struct an_task *ts)
+{
+	int i, j, k, n = 0;
+
+	for (i = 0; i < tester->num_tasks; i++) {
+		struct task *t = tester->tasks[i];
+		struct an_task a;
+
+		if (t->cpu_mask != mask)
+			continue;
+
+		a.index = tester->num_tasks - 1 - i;	//the task list is built backwards
+		a.t = t;
+		a.T = t->period;
+		a.C = (long long)t->exec_time * usage / 100;
+		if (a.C < 1)
+			a.C = 1;
+		a.cs = 0;
+		if (tester->options->locking && t->num_my_locks)
+			a.cs = a.C * tester->options->cs_length / 100;
+		a.B = 0;
+		a.R = RESPONSE_UNKNOWN;
+
+		//insertion sort by period, keeping file order among equals
+		for (j = n; j > 0 && ts[j - 1].T > a.T; j--)
+			ts[j] = ts[j - 1];
+		ts[j] = a;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			if (!ts[j].cs || ts[j].cs <= ts[i].B)
+				continue;
+			for (k = 0; k <= i; k++) {
+				if (shares_lock(ts[j].t, ts[k].t)) {
+					ts[i].B = ts[j].cs;
+					break;
+				}
+			}
+		}
+	}
+
+	return n;
+}
+
+static double utilization(struct an_task *ts, int n, double *max)
+{
+	double u = 0, ui;
+	int i;
+
+	*max = 0;
+	for (i = 0; i < n; i++) {
+		ui = (double)ts[i].C / ts[i].T;
+		u += ui;
+		if (ui > *max)
+			*max = ui;
+	}
+	return u;
+}
+
+/*
+ * Exact response-time analysis for fixed priorities on one CPU.
+ */
+static void rm_response_times(struct an_task *ts, int n)
+{
+	long long R, next = 0;
+	int i, j, steps;
+
+	for (i = 0; i < n; i++) {
+		R = ts[i].C + ts[i].B;
+		for (steps = 0; steps < MAX_STEPS; steps++) {
+			next = ts[i].C + ts[i].B;
+			for (j = 0; j < i; j++)
+				next += div_ceil(R, ts[j].T) * ts[j].C;
+			if (next == R || next > ts[i].T)
+				break;
+			R = next;
+		}
+		if (next > ts[i].T)
+			ts[i].R = RESPONSE_MISS;
+		else
+			ts[i].R = steps < MAX_STEPS ? R : RESPONSE_UNKNOWN;
+	}
+}
+
+/*
+ * The most a task can execute in any window of length L when it meets its
+ * deadline: a carried-in job, whole jobs, and a carried-out job.
+ */
+static long long window_workload(struct an_task *a, long long L)
+{
+	long long R = (a->R > 0 && a->R != RESPONSE_MISS) ? a->R : a->T;
+	long long N = (L + R - a->C) / a->T;
+
+	return N * a->C + min_ll(a->C, L + R - a->C - N * a->T);
+}
+
+/*
+ * The most a task can execute inside the scheduling window of a job of task k
+ * under EDF, where only its jobs with earlier deadlines get ahead of k.
+ */
+static long long edf_interference(struct an_task *a, struct an_task *k)
+{
+	long long R = (a->R > 0 && a->R != RESPONSE_MISS) ? a->R : a->T;
+	long long N = k->T / a->T;
+	long long rest = k->T - N * a->T - (a->T - R);
+
+	return N * a->C + min_ll(a->C, rest > 0 ? rest : 0);
+}
+
+/*
+ * Response-time bounds for global scheduling on m CPUs (Bertogna and Cirinei,
+ * RTSS 2007). Under fixed priorities only the higher-priority tasks interfere;
+ * under EDF every other task can, up to its EDF interference, and the bounds
+ * are refined until none of them shrinks any more.
+ */
+static void global_response_times(struct an_task *ts, int n, int m, int edf)
+{
+	long long R, next = 0, I, w;
+	int i, k, steps, round, changed;
+
+	for (k = 0; k < n; k++)
+		ts[k].R = RESPONSE_MISS;
+
+	for (round = 0, changed = 1; changed && round < 100; round++) {
+		changed = 0;
+		for (k = 0; k < n; k++) {
+			R = ts[k].C + ts[k].B;
+			for (steps = 0; steps < MAX_STEPS; steps++) {
+				I = 0;
+				for (i = 0; i < (edf ? n : k); i++) {
+					if (i == k)
+						continue;
+					w = window_workload(&ts[i], R);
+					if (edf)
+						w = min_ll(w, edf_interference
+							   (&ts[i], &ts[k]));
+					I += min_ll(w, R - ts[k].C + 1);
+				}
+				next = ts[k].C + ts[k].B + I / m;
+				if (next == R || next > ts[k].T)
+					break;
+				R = next;
+			}
+			if (next > ts[k].T || steps == MAX_STEPS)
+				R = RESPONSE_MISS;
+			if (R != ts[k].R) {
+				ts[k].R = R;
+				changed = 1;
+			}
+		}
+		//fixed priorities are settled in one pass, in priority order
+		if (!edf)
+			break;
+	}
+}
+
+/*
+ * The processor demand of all jobs with both release and deadline in [0, t]
+ */
+static long long demand(struct an_task *ts, int n, long long t)
+{
+	long long h = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (t >= ts[i].T)
+			h += ((t - ts[i].T) / ts[i].T + 1) * ts[i].C;
+	return h;
+}
+
+/*
+ * The latest absolute deadline strictly before t, or 0 if there is none
+ */
+static long long deadline_before(struct an_task *ts, int n, long long t)
+{
+	long long d, best = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (t <= ts[i].T)
+			continue;
+		d = ((t - 1 - ts[i].T) / ts[i].T) * ts[i].T + ts[i].T;
+		if (d > best)
+			best = d;
+	}
+	return best;
+}
+
+/*
+ * The length of the synchronous busy period, or -1 if it couldn't be bounded
+ */
+static long long busy_period(struct an_task *ts, int n)
+{
+	long long w = 0, next;
+	int i, steps;
+
+	for (i = 0; i < n; i++)
+		w += ts[i].C;
+
+	for (steps = 0; steps < MAX_STEPS; steps++) {
+		next = 0;
+		for (i = 0; i < n; i++)
+			next += div_ceil(w, ts[i].T) * ts[i].C;
+		if (next == w)
+			return w;
+		w = next;
+	}
+	return -1;
+}
+
+/*
+ * The processor-demand test for EDF on one CPU, using Quick Processor-demand
+ * Analysis (Zhang and Burns, 2009). The blocking of the whole domain is charged
+ * at every point, which keeps the demand monotonic. Returns true if the tasks
+ * are schedulable; *L is set to the length of the busy period.
+ */
+static int edf_qpa(struct an_task *ts, int n, long long *L)
+{
+	long long t, h, horizon, B = 0, dmin, dmax = 0;
+	double u, umax;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (ts[i].B > B)
+			B = ts[i].B;
+		if (ts[i].T > dmax)
+			dmax = ts[i].T;
+	}
+	u = utilization(ts, n, &umax);
+	if (u > 1.0)
+		return 0;
+
+	*L = busy_period(ts, n);
+	if (*L < 0)
+		return 0;
+
+	//with implicit deadlines, nothing can fail after the longest one
+	horizon = *L;
+	if (u < 1.0 && dmax < horizon)
+		horizon = dmax;
+
+	dmin = ts[0].T;
+	t = deadline_before(ts, n, horizon + 1);
+	while ((h = demand(ts, n, t) + B) <= t && h > dmin) {
+		if (h < t)
+			t = h;
+		else
+			t = deadline_before(ts, n, t);
+	}
+
+	return demand(ts, n, t) + B <= dmin;
+}
+
+/*
+ * Worst-case response times under EDF on one CPU (Spuri, 1996): try every
+ * release offset a of the job within the busy period of length L at which its
+ * deadline lines up with another task's, and measure the busy period which
+ * ends with it.
+ */
+static void edf_response_times(struct an_task *ts, int n, long long L)
+{
+	long long a, t, next, worst, steps;
+	int i, j, k;
+
+	for (i = 0; i < n; i++) {
+		worst = 0;
+		steps = 0;
+
+		for (j = 0; j < n && steps < MAX_STEPS; j++) {
+			for (k = 0;; k++) {
+				a = (long long)k * ts[j].T + ts[j].T - ts[i].T;
+				if (a < 0)
+					continue;
+				if (a >= L || steps >= MAX_STEPS)
+					break;
+
+				t = (1 + a / ts[i].T) * ts[i].C;
+				for (; steps < MAX_STEPS; steps++) {
+					int o;
+					next = (1 + a / ts[i].T) * ts[i].C;
+					for (o = 0; o < n; o++) {
+						long long d = a + ts[i].T - ts[o].T;
+						if (o == i || d < 0)
+							continue;
+						next += min_ll(div_ceil(t, ts[o].T),
+							       1 + d / ts[o].T)
+						    * ts[o].C;
+					}
+					if (next == t)
+						break;
+					t = next;
+				}
+
+				if (t - a > worst)
+					worst = t - a;
+			}
+		}
+
+		if (steps >= MAX_STEPS)
+			ts[i].R = RESPONSE_UNKNOWN;
+		else if (worst + ts[i].B > ts[i].T)
+			ts[i].R = RESPONSE_MISS;
+		else
+			ts[i].R = (worst < ts[i].C ? ts[i].C : worst) + ts[i].B;
+	}
+}
+
+/*
+ * Analyse one domain with the tasks in ts[]. Sets their response times and
+ * returns true if the analysis shows the domain schedulable.
+ */
+static int analyze_domain(struct an_task *ts, int n, int ncpus, int kind)
+{
+	double u, umax;
+	long long L;
+	int i, ok = 1;
+
+	if (!n)
+		return 1;
+	u = utilization(ts, n, &umax);
+
+	if (kind == ANALYSIS_RM && ncpus == 1) {
+		rm_response_times(ts, n);
+	} else if (kind == ANALYSIS_EDF && ncpus == 1) {
+		if (!edf_qpa(ts, n, &L)) {
+			for (i = 0; i < n; i++)
+				ts[i].R = RESPONSE_MISS;
+			return 0;
+		}
+		edf_response_times(ts, n, L);
+		return 1;
+	} else {
+		global_response_times(ts, n, ncpus, kind == ANALYSIS_EDF);
+		//the GFB bound holds even where the response times don't
+		if (kind == ANALYSIS_EDF && u <= ncpus - (ncpus - 1) * umax)
+			return 1;
+	}
+
+	for (i = 0; i < n; i++)
+		if (ts[i].R == RESPONSE_MISS || ts[i].R == RESPONSE_UNKNOWN)
+			ok = 0;
+	return ok;
+}
+
+/*
+ * The utilization bound for a domain: Liu and Layland's for RMA on one CPU,
+ * the bound of Bertogna, Cirinei and Lipari for global RMA, 1 for EDF and GFB
+ * for global EDF.
+ */
+static double utilization_bound(int n, int ncpus, int kind, double umax)
+{
+	if (kind == ANALYSIS_RM && ncpus == 1)
+		return n * (pow(2.0, 1.0 / n) - 1);
+	if (kind == ANALYSIS_RM)
+		return ncpus / 2.0 * (1 - umax) + umax;
+	if (ncpus == 1)
+		return 1.0;
+	return ncpus - (ncpus - 1) * umax;
+}
+
+/*
+ * Find the highest CPU usage at which the domain is still schedulable, by
+ * bisection (every test above is sustainable in the execution times).
+ */
+static int breakdown_usage(struct test *tester, unsigned long mask, int ncpus,
+			   int kind, struct an_task *ts)
+{
+	int lo = 0, hi = MAX_USAGE + 1, mid, n;
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		n = domain_tasks(tester, mask, mid, ts);
+		if (analyze_domain(ts, n, ncpus, kind))
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void print_response(struct an_task *a)
+{
+	printf("\tTask %d: period %lld, exec %lld, blocking %lld, ", a->index,
+	       a->T, a->C, a->B);
+	if (a->R == RESPONSE_MISS)
+		printf("response > deadline\n");
+	else if (a->R == RESPONSE_UNKNOWN)
+		printf("response unknown\n");
+	else
+		printf("response %lld usec\n", a->R);
+}
+
+void analyze_taskset(struct test *tester)
+{
+	struct test_app_opts *options = tester->options;
+	int kind = analysis_kind(options->scheduler);
+	char *sched_name = get_sched_name(options->scheduler);
+	struct an_task *ts;
+	int d, n, ncpus, usage, breakdown, sys_breakdown = MAX_USAGE;
+	double u, umax;
+
+	ts = (struct an_task *)malloc(sizeof(struct an_task) *
+				      (tester->num_tasks + 1));
+	if (!ts)
+		fatal_error("Failed to allocate memory.");
+
+	if (kind == ANALYSIS_NONE)
+		printf("No schedulability analysis for %s; "
+		       "showing utilization only\n", sched_name);
+
+	//the point each domain stops being schedulable
+	for (d = 0; kind != ANALYSIS_NONE && d < tester->num_processors &&
+	     tester->domain_masks[d]; d++) {
+		ncpus = __builtin_popcountl(tester->domain_masks[d]);
+		breakdown = breakdown_usage(tester, tester->domain_masks[d],
+					    ncpus, kind, ts);
+		n = domain_tasks(tester, tester->domain_masks[d], breakdown, ts);
+		u = utilization(ts, n, &umax);
+		printf("Domain %d (cpus 0x%lx): %d tasks on %d cpu%s, "
+		       "breakdown at %d%% cpu usage (utilization %.3f)\n",
+		       d, tester->domain_masks[d], n, ncpus,
+		       ncpus == 1 ? "" : "s", breakdown, u);
+		if (breakdown < sys_breakdown)
+			sys_breakdown = breakdown;
+	}
+	if (kind != ANALYSIS_NONE)
+		printf("Breakdown: %d%% cpu usage\n", sys_breakdown);
+
+	for (usage = options->cpu_usage; usage <= options->end_usage;
+	     usage += options->interval) {
+		for (d = 0; d < tester->num_processors &&
+		     tester->domain_masks[d]; d++) {
+			int i, ok;
+
+			ncpus = __builtin_popcountl(tester->domain_masks[d]);
+			n = domain_tasks(tester, tester->domain_masks[d], usage,
+					 ts);
+			u = utilization(ts, n, &umax);
+			printf("%.2f", ((double)usage) / 100);
+			if (sched_name)
+				printf("/%s", sched_name);
+			printf(": Domain %d: utilization %.3f", d, u);
+			if (kind == ANALYSIS_NONE) {
+				printf(" on %d cpu%s\n", ncpus,
+				       ncpus == 1 ? "" : "s");
+				continue;
+			}
+
+			ok = analyze_domain(ts, n, ncpus, kind);
+			printf(" (bound %.3f), %s\n",
+			       utilization_bound(n, ncpus, kind, umax),
+			       ok ? "schedulable" : "not schedulable");
+			for (i = 0; i < n; i++)
+				print_response(&ts[i]);
+		}
+	}
+
+	free(ts);
+}
@@ -0,0 +1,387 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Campaigns run a whole matrix of tests, one point (a scheduler, taskset,
+ * workload, critical section length and usage) at a time, each in a separate
+ * invocation of sched_test_app in Excel format. The output of every point which
+ * completes is kept in the results store, a directory with a file per point
+ * named by a hash of the taskset's contents and the options of the point, so
+ * running the campaign again only runs the points which are missing.
+ *
+ * The campaign file has the same layout as a taskset file: '#' comments, and
+ * lines starting with a letter followed by tab-separated fields.
+ *
+ *	S	scheduler...		schedulers to run (required)
+ *	F	taskset...		taskset files to run (required)
+ *	C	start	end	interval	usages to run (required)
+ *	R	run-time		length of each run in seconds (required)
+ *	W	workload...		workloads to run (default burn_loop)
+ *	L	cs-length...		critical section lengths, 0 for no locking
+ *	K	backend			libchronos backend to run on
+ *	O	options			any other options, separated by spaces
+ *	D	directory		results store (default <campaign>.results)
+ *
+ * Taskset names may contain spaces, so fields are separated by tabs only.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "campaign.h"
+
+#define CAMPAIGN_MAX_VALUES 64
+#define CAMPAIGN_MAX_ARGS   (CAMPAIGN_MAX_VALUES + 20)
+#define CAMPAIGN_LINE_SIZE  4096
+
+struct campaign {
+	char *schedulers[CAMPAIGN_MAX_VALUES];
+	int num_schedulers;
+	char *tasksets[CAMPAIGN_MAX_VALUES];
+	unsigned long long taskset_hashes[CAMPAIGN_MAX_VALUES];
+	int num_tasksets;
+	char *workloads[CAMPAIGN_MAX_VALUES];
+	int num_workloads;
+	char *cs_lengths[CAMPAIGN_MAX_VALUES];
+	int num_cs_lengths;
+	int cpu_usage, end_usage, interval;
+	char *run_time;
+	char *backend;
+	char *options[CAMPAIGN_MAX_VALUES];
+	int num_options;
+	char *store;
+};
+
+/* FNV-1a, which is plenty to tell points apart */
+#define HASH_INIT  14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+static unsigned long long hash_bytes(unsigned long long hash, const char *buf,
+				     size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)buf[i];
+		hash *= HASH_PRIME;
+	}
+	return hash;
+}
+
+static unsigned long long hash_file(char *filename)
+{
+	unsigned long long hash = HASH_INIT;
+	char buf[CAMPAIGN_LINE_SIZE];
+	size_t len;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		printf("Error: Failed to open taskset file %s\n", filename);
+		exit(1);
+	}
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		hash = hash_bytes(hash, buf, len);
+	fclose(f);
+	return hash;
+}
+
+static char *copy_string(char *s)
+{
+	char *copy = strdup(s);
+	if (!copy)
+		fatal_error("Failed to allocate memory.");
+	return copy;
+}
+
+/*
+ * Append the fields of a campaign line, split on @sep, to @values.
+ */
+static void add_fields(char *line, char *sep, char **values, int *num)
+{
+	char *field, *save;
+
+	for (field = strtok_r(line, sep, &save); field;
+	     field = strtok_r(NULL, sep, &save)) {
+		if (*num == CAMPAIGN_MAX_VALUES)
+			fatal_error("Too many values on one campaign line.");
+		values[(*num)++] = copy_string(field);
+	}
+}
+
+static void read_campaign(char *filename, struct campaign *c)
+{
+	char line[CAMPAIGN_LINE_SIZE], *fields;
+	char *usages[CAMPAIGN_MAX_VALUES];
+	int i, num_usages = 0;
+	FILE *f;
+
+	memset(c, 0, sizeof(*c));
+
+	f = fopen(filename, "r");
+	if (!f)
+		fatal_error("Failed to open campaign file.");
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+		if (line[1] != '\t' && line[1] != ' ')
+			fatal_error("Ill-formed campaign file: "
+				    "a letter must be followed by a tab.");
+		fields = line + 2;
+
+		switch (line[0]) {
+		case 'S':
+			add_fields(fields, "\t", c->schedulers,
+				   &c->num_schedulers);
+			break;
+		case 'F':
+			add_fields(fields, "\t", c->tasksets, &c->num_tasksets);
+			break;
+		case 'W':
+			add_fields(fields, "\t", c->workloads, &c->num_workloads);
+			break;
+		case 'L':
+			add_fields(fields, "\t", c->cs_lengths,
+				   &c->num_cs_lengths);
+			break;
+		case 'C':
+			add_fields(fields, "\t ", usages, &num_usages);
+			break;
+		case 'R':
+			c->run_time = copy_string(fields);
+			break;
+		case 'K':
+			c->backend = copy_string(fields);
+			break;
+		case 'O':
+			add_fields(fields, "\t ", c->options, &c->num_options);
+			break;
+		case 'D':
+			c->store = copy_string(fields);
+			break;
+		default:
+			fatal_error("Ill-formed campaign file: line doesn't begin "
+				    "with '#', 'S', 'F', 'C', 'R', 'W', 'L', 'K', "
+				    "'O' or 'D'.");
+		}
+	}
+	fclose(f);
+
+	if (!c->num_schedulers || !c->num_tasksets || num_usages != 3 ||
+	    !c->run_time)
+		fatal_error("The campaign file must give the schedulers ('S'), "
+			    "tasksets ('F'), usages ('C' start end interval) "
+			    "and run time ('R').");
+
+	c->cpu_usage = atoi(usages[0]);
+	c->end_usage = atoi(usages[1]);
+	c->interval = atoi(usages[2]);
+	if (c->cpu_usage <= 0 || c->end_usage < c->cpu_usage ||
+	    c->interval <= 0)
+		fatal_error("The campaign's usages must be a start, "
+			    "an end no lower than it, and a positive interval.");
+	for (i = 0; i < num_usages; i++)
+		free(usages[i]);
+
+	if (!c->num_workloads)
+		c->workloads[c->num_workloads++] = copy_string("burn_loop");
+	if (!c->num_cs_lengths)
+		c->cs_lengths[c->num_cs_lengths++] = copy_string("0");
+
+	if (!c->store) {
+		c->store = (char *)malloc(strlen(filename) + sizeof(".results"));
+		if (!c->store)
+			fatal_error("Failed to allocate memory.");
+		sprintf(c->store, "%s.results", filename);
+	}
+
+	for (i = 0; i < c->num_tasksets; i++)
+		c->taskset_hashes[i] = hash_file(c->tasksets[i]);
+}
+
+/*
+ * Build the arguments which run one point of the campaign, and the key it's
+ * stored under. The taskset is identified by its contents, not its name.
+ */
+static unsigned long long point_args(struct campaign *c, char **args,
+				     char *self, int taskset, char *sched,
+				     char *workload, char *cs, char *usage)
+{
+	unsigned long long key = c->taskset_hashes[taskset];
+	int i, n = 0;
+
+	args[n++] = self;
+	args[n++] = "-x";
+	args[n++] = "-s";
+	args[n++] = sched;
+	args[n++] = "-c";
+	args[n++] = usage;
+	args[n++] = "-r";
+	args[n++] = c->run_time;
+	args[n++] = "-w";
+	args[n++] = workload;
+	if (atoi(cs)) {
+		args[n++] = "-l";
+		args[n++] = cs;
+	}
+	if (c->backend) {
+		args[n++] = "-k";
+		args[n++] = c->backend;
+	}
+	for (i = 0; i < c->num_options; i++)
+		args[n++] = c->options[i];
+	args[n++] = "-f";
+	args[n++] = c->tasksets[taskset];
+	args[n] = NULL;
+
+	//everything but the program and the taskset's name
+	for (i = 1; i < n - 1; i++)
+		key = hash_bytes(key, args[i], strlen(args[i]) + 1);
+	return key;
+}
+
+/*
+ * Run one point with its output going to @filename. Returns 0 if it completed.
+ */
+static int run_point(char **args, char *filename)
+{
+	int fd, status;
+	pid_t pid;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		fatal_error("Failed to create a file in the results store.");
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1)
+		fatal_error("Failed to fork a campaign run.");
+	if (pid == 0) {
+		if (dup2(fd, STDOUT_FILENO) < 0)
+			exit(1);
+		execv(args[0], args);
+		exit(1);
+	}
+	close(fd);
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+/*
+ * Print the result of a stored point: the last line of its output, which is
+ * the one Excel line of results.
+ */
+static void print_point(char *filename, char *taskset, char *workload,
+			char *cs)
+{
+	char line[CAMPAIGN_LINE_SIZE], last[CAMPAIGN_LINE_SIZE] = "";
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f)
+		fatal_error("Failed to open a file in the results store.");
+	while (fgets(line, sizeof(line), f))
+		if (line[0] != '\n')
+			strcpy(last, line);
+	fclose(f);
+
+	printf("%s,%s,%s,%s", taskset, workload, cs, last);
+}
+
+int run_campaign(char *filename, char *self)
+{
+	struct campaign c;
+	char *args[CAMPAIGN_MAX_ARGS + 1];
+	char usage[16], *path, *tmp_path;
+	char *taskset, *sched, *workload, *cs;
+	unsigned long long key;
+	int i, p, t, u, num_usages, num_points;
+	int ran = 0, stored = 0, failed = 0;
+	struct stat st;
+
+	read_campaign(filename, &c);
+	num_usages = (c.end_usage - c.cpu_usage) / c.interval + 1;
+	num_points = c.num_tasksets * c.num_schedulers * c.num_workloads *
+	    c.num_cs_lengths * num_usages;
+
+	if (mkdir(c.store, 0755) && errno != EEXIST)
+		fatal_error("Failed to create the results store.");
+
+	path = (char *)malloc(strlen(c.store) + 32);
+	tmp_path = (char *)malloc(strlen(c.store) + 32);
+	if (!path || !tmp_path)
+		fatal_error("Failed to allocate memory.");
+
+	printf("#Taskset,Workload,CS length,Scheduler,Usage,"
+	       "Deadlines met,Utility accrued,Max tardiness\n");
+
+	//the usage changes fastest, then the critical section length, the
+	//workload, the scheduler and finally the taskset
+	for (p = 0; p < num_points; p++) {
+		i = p;
+		u = c.cpu_usage + i % num_usages * c.interval;
+		i /= num_usages;
+		cs = c.cs_lengths[i % c.num_cs_lengths];
+		i /= c.num_cs_lengths;
+		workload = c.workloads[i % c.num_workloads];
+		i /= c.num_workloads;
+		sched = c.schedulers[i % c.num_schedulers];
+		t = i / c.num_schedulers;
+		taskset = c.tasksets[t];
+
+		sprintf(usage, "%d", u);
+		key = point_args(&c, args, self, t, sched, workload, cs, usage);
+		sprintf(path, "%s/%016llx", c.store, key);
+
+		//a point is only stored once it has completed, so an interrupted
+		//campaign picks up again at the point it was on
+		if (stat(path, &st)) {
+			if (ran)
+				sleep(1);
+			ran++;
+			sprintf(tmp_path, "%s/.%016llx", c.store, key);
+			if (run_point(args, tmp_path) || rename(tmp_path, path)) {
+				unlink(tmp_path);
+				printf("%s,%s,%s,%s,%d,failed\n", taskset,
+				       workload, cs, sched, u);
+				failed++;
+				continue;
+			}
+		} else
+			stored++;
+
+		print_point(path, taskset, workload, cs);
+	}
+
+	printf("#%d points run, %d from %s, %d failed\n", ran - failed,
+	       stored, c.store, failed);
+
+	free(path);
+	free(tmp_path);
+	return failed;
+}
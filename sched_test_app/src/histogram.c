@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * The bucket a magnitude goes in.
+ */
+static int bucket_of(unsigned long long v)
+{
+	int e;
+
+	if (v < HIST_LINEAR)
+		return v;
+	if (v >> HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+
+	e = 63 - __builtin_clzll(v);	//the highest bit set
+	return (e - HIST_SUB_BITS + 1) * HIST_LINEAR +
+	    ((v >> (e - HIST_SUB_BITS)) & (HIST_LINEAR - 1));
+}
+
+/*
+ * The middle of the range of magnitudes a bucket holds.
+ */
+static unsigned long long bucket_value(int b)
+{
+	int e;
+	unsigned long long low;
+
+	if (b < HIST_LINEAR)
+		return b;
+
+	e = b / HIST_LINEAR + HIST_SUB_BITS - 1;
+	low = (unsigned long long)(HIST_LINEAR + b % HIST_LINEAR) <<
+	    (e - HIST_SUB_BITS);
+	return low + (1ULL << (e - HIST_SUB_BITS)) / 2;
+}
+
+void hist_clear(struct histogram *h)
+{
+	memset(h, 0, sizeof(struct histogram));
+}
+
+void hist_record(struct histogram *h, long long value)
+{
+	if (value < 0)
+		h->neg_counts[bucket_of(-value)]++;
+	else
+		h->counts[bucket_of(value)]++;
+
+	if (!h->count || value < h->min)
+		h->min = value;
+	if (!h->count || value > h->max)
+		h->max = value;
+	h->count++;
+}
+
+void hist_merge(struct histogram *to, struct histogram *from)
+{
+	int i;
+
+	if (!from->count)
+		return;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		to->counts[i] += from->counts[i];
+		to->neg_counts[i] += from->neg_counts[i];
+	}
+
+	if (!to->count || from->min < to->min)
+		to->min = from->min;
+	if (!to->count || from->max > to->max)
+		to->max = from->max;
+	to->count += from->count;
+}
+
+long long hist_percentile(struct histogram *h, double percent)
+{
+	unsigned long rank, seen = 0;
+	long long value = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	//the rank of the value we're after, counting from 1
+	rank = (unsigned long)(percent / 100 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->count)
+		rank = h->count;
+
+	//the negative values come first, from the largest magnitude down
+	for (i = HIST_BUCKETS - 1; i >= 0 && seen < rank; i--) {
+		seen += h->neg_counts[i];
+		value = -(long long)bucket_value(i);
+	}
+	for (i = 0; i < HIST_BUCKETS && seen < rank; i++) {
+		seen += h->counts[i];
+		value = bucket_value(i);
+	}
+
+	//a bucket's middle can be past the values actually recorded
+	if (value < h->min)
+		value = h->min;
+	if (value > h->max)
+		value = h->max;
+	return value;
+}
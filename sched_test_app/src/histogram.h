@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/*
+ * Log-linear histograms of signed microsecond values. Magnitudes below
+ * HIST_LINEAR each get a bucket of their own; above that, every power of two
+ * is split into HIST_LINEAR buckets, so any value is known to within 1/16th of
+ * it, up to about 71 minutes. A histogram is a fixed size and only ever
+ * written by the task that owns it, so it can live in shared memory and be
+ * read by the main process without any locking.
+ */
+#define HIST_SUB_BITS	4
+#define HIST_LINEAR	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	32
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_LINEAR)
+
+struct histogram {
+	unsigned int counts[HIST_BUCKETS];	//values >= 0, by magnitude
+	unsigned int neg_counts[HIST_BUCKETS];	//values < 0, by magnitude
+	unsigned long count;
+	long long min;
+	long long max;
+};
+
+void hist_clear(struct histogram *h);
+void hist_record(struct histogram *h, long long value);
+void hist_merge(struct histogram *to, struct histogram *from);
+
+/*
+ * The value below which percent of the values recorded fall, to within the
+ * width of its bucket.
+ */
+long long hist_percentile(struct histogram *h, double percent);
+
+#endif				/* HISTOGRAM_H */
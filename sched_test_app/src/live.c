@@ -0,0 +1,145 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "tester.h"
+#include "live.h"
+
+static struct live_stats *live;
+static size_t live_size;
+static char live_name[32];
+static pid_t live_owner;	//the main process, the only one to remove the object
+
+/*
+ * Remove the shared memory object however the main process exits, so that a
+ * run which fails doesn't leave it behind.
+ */
+static void live_unlink()
+{
+	if (live && getpid() == live_owner)
+		shm_unlink(live_name);
+}
+
+void live_open(struct test *tester)
+{
+	char *sched_name = get_sched_name(tester->options->scheduler);
+	int fd, i;
+
+	live_owner = getpid();
+	snprintf(live_name, sizeof(live_name), LIVE_SHM_PREFIX "%d",
+		 live_owner);
+	live_size = sizeof(struct live_stats) +
+	    sizeof(struct live_task) * tester->num_tasks;
+
+	fd = shm_open(live_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd == -1)
+		fatal_error("Failed to create the live statistics.");
+	if (ftruncate(fd, live_size))
+		fatal_error("Failed to size the live statistics.");
+	live = mmap(0, live_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (live == MAP_FAILED) {
+		live = 0;
+		shm_unlink(live_name);
+		fatal_error("Failed to map the live statistics.");
+	}
+	atexit(live_unlink);
+
+	live->state = LIVE_STARTING;
+	live->num_tasks = tester->num_tasks;
+	if (sched_name)
+		strncpy(live->scheduler, sched_name,
+			sizeof(live->scheduler) - 1);
+	for (i = 0; i < tester->num_tasks; i++) {
+		struct task *t = tester->tasks[i];
+
+		t->live = &live->tasks[tester->num_tasks - 1 - i];
+		t->live->period = t->period;
+	}
+	__atomic_store_n(&live->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+}
+
+void live_close(struct test *tester)
+{
+	int i;
+
+	live_write_begin(&live->seq);
+	live->state = LIVE_DONE;
+	live_write_end(&live->seq);
+
+	for (i = 0; i < tester->num_tasks; i++)
+		tester->tasks[i]->live = 0;
+	shm_unlink(live_name);
+	munmap(live, live_size);
+	live = 0;
+}
+
+void live_begin_run(struct test *tester)
+{
+	int i;
+
+	//no task is running, so their entries can be set from here
+	for (i = 0; i < tester->num_tasks; i++) {
+		struct task *t = tester->tasks[i];
+
+		live_write_begin(&t->live->seq);
+		t->live->planned = t->warmup_releases + t->max_releases;
+		t->live->releases = 0;
+		t->live->counted = 0;
+		t->live->met = 0;
+		t->live->aborted = 0;
+		t->live->max_tardiness = 0;
+		live_write_end(&t->live->seq);
+	}
+
+	live_write_begin(&live->seq);
+	live->state = LIVE_RUNNING;
+	live->run++;
+	live->usage = tester->options->cpu_usage;
+	clock_gettime(CLOCK_REALTIME, &live->start);
+	live->run_ms = (long)(tester->options->warmup +
+			      tester->options->run_time) * THOUSAND /
+	    tester->options->compression;
+	live_write_end(&live->seq);
+}
+
+void live_end_run(struct test *tester)
+{
+	live_write_begin(&live->seq);
+	live->state = LIVE_STARTING;
+	live_write_end(&live->seq);
+}
+
+void live_update_task(struct task *t)
+{
+	struct live_task *l = t->live;
+
+	if (!l)
+		return;
+
+	live_write_begin(&l->seq);
+	l->releases = t->num_releases + 1;
+	l->counted = t->num_counted;
+	l->met = t->deadlines_met;
+	l->aborted = t->num_aborted;
+	l->max_tardiness = -t->max_tardiness;
+	live_write_end(&l->seq);
+}
@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifndef LIVE_H
+#define LIVE_H
+
+/*
+ * Live statistics, which sched_test_app publishes in the POSIX shared memory
+ * object LIVE_SHM_PREFIX<pid> while it runs, for chronos_top to read. Each task
+ * keeps its own entry up to date at the end of every job, and the main process
+ * updates the header at the start and end of every run. Every entry has a
+ * sequence lock of its own, so its one writer never waits, and a reader copies
+ * it again if the writer was in the middle of it.
+ */
+#define LIVE_SHM_PREFIX	"/chronos_top."
+#define LIVE_MAGIC	0x4c495645	//"LIVE"
+
+#define LIVE_STARTING	0	//setting up, or between runs
+#define LIVE_RUNNING	1
+#define LIVE_DONE	2	//every run of the batch is over
+
+struct live_task {
+	unsigned int seq;
+	unsigned long period;	//microseconds
+	unsigned int planned;	//releases the task will have in the run
+	unsigned int releases;	//jobs done so far, counted or not
+	unsigned int counted;
+	unsigned int met;
+	unsigned int aborted;
+	long max_tardiness;	//microseconds the latest counted job finished after its deadline
+};
+
+struct live_stats {
+	unsigned int magic;
+	unsigned int seq;
+	int state;		//one of LIVE_STARTING, LIVE_RUNNING or LIVE_DONE
+	int run;		//runs started so far
+	int usage;		//percent of each task's execution time used
+	char scheduler[16];
+	struct timespec start;	//when the run started, on CLOCK_REALTIME
+	long run_ms;		//milliseconds it is planned to last, warm-up included
+	int num_tasks;
+	struct live_task tasks[];	//in the order the taskset lists them
+};
+
+static inline void live_write_begin(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void live_write_end(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy @size bytes guarded by @seq from @from to @to, as they were at some
+ * instant when nobody was writing them.
+ */
+static inline void live_read(unsigned int *seq, void *to, const void *from,
+			     size_t size)
+{
+	unsigned int start;
+
+	do {
+		while ((start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		memcpy(to, from, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(seq, __ATOMIC_RELAXED) != start);
+}
+
+struct test;
+struct task;
+
+/*
+ * Create the shared memory object for @tester's taskset and point every task
+ * at its entry. Must be called after the taskset is read and before anything
+ * forks.
+ */
+void live_open(struct test *tester);
+void live_close(struct test *tester);
+
+/*
+ * Publish the start of a run, once its releases are worked out, and its end.
+ */
+void live_begin_run(struct test *tester);
+void live_end_run(struct test *tester);
+
+/*
+ * Publish @t's statistics as they stand after its last job.
+ */
+void live_update_task(struct task *t);
+
+#endif				/* LIVE_H */
@@ -27,12 +27,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <math.h>
 #include <sys/mman.h>
 
 #include "utils.h"
 #include "tester.h"
 #include "tester_types.h"
 #include "workload.h"
+#include "campaign.h"
+#include "trace.h"
 
 void print_usage()
 {
@@ -55,16 +58,60 @@ void print_usage()
 	printf("  -h            Enable HUA abort handlers\n");
 	printf("  -d            Enable deadlock prevention\n");
 	printf("  -z            "
-	       "Don't run the test, just print the hyper-period\n");
+	       "Don't run the test, just analyse the taskset\n");
 	printf("  -l cs-length  Enable locking, and provide critical\n");
 	printf("                section length\n");
 	printf("  -n            "
 	       "Enable nested locking (as opposed to sequential)\n");
+	printf("  -k backend    "
+	       "Select the libchronos backend: \"kernel\" (default) or\n");
+	printf("                \"sim\" to run in simulated virtual time,\n");
+	printf("                \"user\" to schedule in userspace on SCHED_FIFO,\n");
+	printf("                or \"deadline\" to run EDF on SCHED_DEADLINE\n");
+	printf("  -W warm-up    "
+	       "Leave the jobs of the first warm-up seconds of each\n");
+	printf("                run out of the statistics (run-time follows it)\n");
+	printf("  -S width      "
+	       "End a run early once the 95%% confidence intervals of\n");
+	printf("                the deadline satisfaction and accrued utility\n");
+	printf("                ratios are within +/- width percent\n");
+	printf("  -a notify     "
+	       "How aborted tasks find out: \"poll\" (default) the abort\n");
+	printf("                flag, or \"signal\" (not with the kernel backend)\n");
+	printf("  -T factor     "
+	       "Compress time: divide every period, execution time and\n");
+	printf("                the run and warm-up times by factor, as long\n");
+	printf("                as the per-job overhead stays negligible\n");
+	printf("  -K stack      "
+	       "Give each task thread a stack of that many KiB\n");
+	printf("                (default %d, 0 for the system default)\n",
+	       DEFAULT_STACK_KB);
+	printf("  -P            "
+	       "Count the cycles, instructions, LLC and dTLB misses,\n");
+	printf("                context switches and migrations of every job\n");
+	printf("  -m            "
+	       "Publish live statistics while running, for chronos_top\n");
+	printf("  -O trace      "
+	       "Record every job of every task to the binary trace file\n");
+	printf("  -E trace      "
+	       "Convert a trace file to Chrome/Perfetto JSON on stdout\n");
 	printf("\n");
 	printf("Batch Mode Options:\n");
 	printf("  -b            Enable batch mode\n");
 	printf("  -e end-usage  The end cpu-usage (used in batch mode)\n");
 	printf("  -i interval   The interval for each iteration in batch\n");
+	printf("  -j partitions "
+	       "Run up to that many usages at once, each on a copy of\n");
+	printf("                the taskset moved to CPUs of its own\n");
+	printf("  -u threshold  "
+	       "Bisect for the usage where the percentage of\n");
+	printf("                deadlines met falls below threshold, to\n");
+	printf("                within interval, instead of sweeping\n");
+	printf("\n");
+	printf("Campaigns:\n");
+	printf("  -C campaign   "
+	       "Run every test a campaign file lists, skipping those\n");
+	printf("                already in its results store\n");
 	printf("\n");
 	printf("Output Formatting (mutually exclusive of each other):\n");
 	printf("  -v            Enable verbose mode\n");
@@ -108,6 +155,73 @@ int validate_options(struct test_app_opts *options)
 		ret = 1;
 	}
 
+	if (options->partitions < 1) {
+		printf("Error: The number of partitions must be at least 1.\n");
+		ret = 1;
+	}
+
+	if (options->warmup < 0 || options->warmup > 3600) {
+		printf("Invalid warm-up time. "
+		       "Must be between 0 and 3600 seconds.\n");
+		ret = 1;
+	}
+
+	if (!(options->confidence >= 0 && options->confidence <= 50)) {
+		printf("Error: The confidence interval width must be "
+		       "between 0 and 50 percent.\n");
+		ret = 1;
+	}
+
+	if (options->stack_kb &&
+	    (options->stack_kb < 0 ||
+	     options->stack_kb * 1024L < PTHREAD_STACK_MIN)) {
+		printf("Error: Task stacks must be at least %ld KiB.\n",
+		       (long)PTHREAD_STACK_MIN / 1024);
+		ret = 1;
+	}
+
+	if (options->compression < 1 || options->compression > 1000) {
+		printf("Error: The time compression factor must be "
+		       "between 1 and 1000.\n");
+		ret = 1;
+	}
+
+	if (options->trace_filename && options->partitions > 1) {
+		printf("Error: Partitioned batches can't be traced.\n");
+		ret = 1;
+	}
+
+	if (options->live && options->partitions > 1) {
+		printf("Error: Partitioned batches can't publish "
+		       "live statistics.\n");
+		ret = 1;
+	}
+
+	if (options->breakdown < 0 || options->breakdown > 100) {
+		printf("Error: The breakdown threshold must be "
+		       "between 0 and 100.\n");
+		ret = 1;
+	}
+
+	if (options->breakdown && !options->batch_mode) {
+		printf("Error: Searching for the breakdown usage "
+		       "needs batch mode.\n");
+		ret = 1;
+	}
+
+	if (options->breakdown && options->partitions > 1) {
+		printf("Error: The breakdown search can't be partitioned.\n");
+		ret = 1;
+	}
+
+	if (options->partitions > 1 &&
+	    (options->backend == CHRONOS_BACKEND_SIM ||
+	     options->backend == CHRONOS_BACKEND_DEADLINE)) {
+		printf("Error: Partitioned batches need the kernel "
+		       "or user backend.\n");
+		ret = 1;
+	}
+
 	if (options->batch_mode && options->end_usage < options->cpu_usage) {
 		printf("Batchmode selected, "
 		       "but end usage is less than start usage.\n");
@@ -145,14 +259,24 @@ int validate_options(struct test_app_opts *options)
 				i = 0;\
 			} while(0)
 
+//an argument which isn't a number becomes NAN, which fails every range check
+#define get_double(a,d) do { \
+			char *end; \
+			d = strtod(a, &end); \
+			if (end == a || *end) \
+				d = NAN; \
+			} while(0)
+
 /*
  * Parse all the arguments into the options struct and call run_test()
  */
 int main(int argc, char *argv[])
 {
-	char optstring[] = "c:e:f:i:l:r:s:t:w:bdghnopvxz";
+	char optstring[] = "a:c:e:f:i:j:k:l:r:s:t:u:w:C:E:K:O:S:T:W:bdghmnopPvxz";
 	int c;
 	char *sched_name = 0, *workload_name = 0, *timing_name = 0;
+	char *backend_name = 0, *notify_name = 0, *campaign_name = 0;
+	char *export_name = 0;
 	int index;
 	struct test_app_opts options = {
 		.output_format = OUTPUT_LOG,
@@ -165,15 +289,28 @@ int main(int argc, char *argv[])
 		.enable_hua = 0,
 		.deadlock_prevention = 0,
 		.no_run = 0,
+		.backend = CHRONOS_BACKEND_KERNEL,
+		.abort_notify = CHRONOS_ABORT_POLL,
 		.locking = NO_LOCKING,
 		.cs_length = 0,
 		.batch_mode = 0,
 		.end_usage = 0,
-		.interval = 0
+		.interval = 0,
+		.partitions = 1,
+		.breakdown = 0,
+		.warmup = 0,
+		.confidence = 0,
+		.stack_kb = DEFAULT_STACK_KB,
+		.compression = 1,
+		.trace_filename = 0,
+		.perf_counters = 0,
+		.live = 0
 	};
 
-	//Minimum 8 arguments (i.e. 4 actual flags and their corresponding textual arguments)
-	if (argc < 8) {
+	//Minimum 8 arguments (i.e. 4 actual flags and their corresponding
+	//textual arguments), or a campaign or trace to convert
+	if (argc < 8 && !(argc == 3 && (!strcmp(argv[1], "-C") ||
+					!strcmp(argv[1], "-E")))) {
 		printf("Error: Provide the scheduler, cpu usage,"
 		       " runtime and taskset filename.\n\n");
 		print_usage();
@@ -183,6 +320,10 @@ int main(int argc, char *argv[])
 	/* Handle command line arguments */
 	while ((c = getopt(argc, argv, optstring)) != -1) {
 		switch (c) {
+		case 'a':
+			notify_name = optarg;
+			break;
+
 		case 'b':
 			options.batch_mode = 1;
 			break;
@@ -191,6 +332,14 @@ int main(int argc, char *argv[])
 			get_integer(optarg, options.cpu_usage);
 			break;
 
+		case 'C':
+			campaign_name = optarg;
+			break;
+
+		case 'E':
+			export_name = optarg;
+			break;
+
 		case 'd':
 			options.deadlock_prevention = 1;
 			break;
@@ -215,11 +364,27 @@ int main(int argc, char *argv[])
 			get_integer(optarg, options.interval);
 			break;
 
+		case 'j':
+			get_integer(optarg, options.partitions);
+			break;
+
+		case 'k':
+			backend_name = optarg;
+			break;
+
+		case 'K':
+			get_integer(optarg, options.stack_kb);
+			break;
+
 		case 'l':
 			get_integer(optarg, options.cs_length);
 			options.locking |= LOCKING;
 			break;
 
+		case 'm':
+			options.live = 1;
+			break;
+
 		case 'n':
 			options.locking |= NESTED_LOCKING;
 			break;
@@ -228,10 +393,19 @@ int main(int argc, char *argv[])
 			options.output_format = OUTPUT_LOG;
 			break;
 
+		case 'O':
+			options.trace_filename = optarg;
+			break;
+
 		case 'p':
 			options.priority_inheritance = 1;
 			break;
 
+		case 'P':
+			options.perf_counters = 1;
+			break;
+
+
 		case 'r':
 			get_integer(optarg, options.run_time);
 			break;
@@ -240,10 +414,22 @@ int main(int argc, char *argv[])
 			sched_name = optarg;
 			break;
 
+		case 'S':
+			get_double(optarg, options.confidence);
+			break;
+
 		case 't':
 			timing_name = optarg;
 			break;
 
+		case 'T':
+			get_integer(optarg, options.compression);
+			break;
+
+		case 'u':
+			get_integer(optarg, options.breakdown);
+			break;
+
 		case 'v':
 			options.output_format = OUTPUT_VERBOSE;
 			break;
@@ -252,6 +438,10 @@ int main(int argc, char *argv[])
 			workload_name = optarg;
 			break;
 
+		case 'W':
+			get_integer(optarg, options.warmup);
+			break;
+
 		case 'x':
 			options.output_format = OUTPUT_EXCEL;
 			break;
@@ -262,7 +452,12 @@ int main(int argc, char *argv[])
 
 		case '?':
 			if (optopt == 'f' || optopt == 'l' || optopt == 's' ||
-			    optopt == 'c' || optopt == 'r' || optopt == 'w')
+			    optopt == 'c' || optopt == 'r' || optopt == 'w' ||
+			    optopt == 'k' || optopt == 'a' || optopt == 'j' ||
+			    optopt == 'u' || optopt == 'C' || optopt == 'E' ||
+			    optopt == 'K' || optopt == 'O' ||
+			    optopt == 'S' || optopt == 'T' ||
+			    optopt == 'W')
 				printf("Option -%c requires an argument.\n",
 				       (char)optopt);
 		default:
@@ -279,6 +474,14 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	//a campaign runs each of its tests as a separate invocation of ourselves
+	if (campaign_name)
+		return run_campaign(campaign_name, "/proc/self/exe") ? 1 : 0;
+
+	//converting a trace doesn't run anything
+	if (export_name)
+		return export_trace(export_name);
+
 	//convert scheduling algorithm string into integer constant for that algo
 	if (sched_name)
 		options.scheduler = find_scheduler(sched_name);
@@ -303,13 +506,39 @@ int main(int argc, char *argv[])
 	} else
 		options.timing_method = TIMING_TIMER;
 
+	//select the libchronos backend before anything forks
+	if (backend_name) {
+		options.backend = chronos_find_backend(backend_name);
+		if (options.backend < 0)
+			fatal_error("Backend must be one of \"kernel\", \"sim\", "
+				    "\"user\" or \"deadline\"");
+	} else
+		options.backend = chronos_get_backend();
+	if (chronos_set_backend(options.backend))
+		fatal_error("Failed to initialize the libchronos backend.");
+
+	//the abort delivery mode is inherited by the thread groups too
+	if (notify_name) {
+		if (!strcmp(notify_name, "poll"))
+			options.abort_notify = CHRONOS_ABORT_POLL;
+		else if (!strcmp(notify_name, "signal"))
+			options.abort_notify = CHRONOS_ABORT_SIGNAL;
+		else
+			fatal_error("Abort notification must be one of "
+				    "\"poll\" or \"signal\"");
+	}
+	if (set_abort_notify(options.abort_notify))
+		fatal_error("The selected backend can't deliver aborts "
+			    "by signal.");
+
 	//Make sure the options we've collected can peacefully coexist
 	if (validate_options(&options)) {
 		print_usage();
 		return 1;
 	}
-	// Lock the memory space
-	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+	// Lock the memory space (a simulated run doesn't need to, nor root)
+	if (options.backend != CHRONOS_BACKEND_SIM
+	    && mlockall(MCL_CURRENT | MCL_FUTURE)) {
 		printf("Error: Unable to lock the memory space.\n");
 		printf("Make sure you are running with sudo or root.\n");
 		return 1;
@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+char *perf_counter_names[PERF_COUNTERS] = {
+	"cycles",
+	"instructions",
+	"LLC misses",
+	"dTLB misses",
+	"context switches",
+	"migrations"
+};
+
+#define CACHE_MISSES(cache) (PERF_COUNT_HW_CACHE_##cache | \
+			     PERF_COUNT_HW_CACHE_OP_READ << 8 | \
+			     PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static struct {
+	unsigned int type;
+	unsigned long long config;
+} perf_events[PERF_COUNTERS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, CACHE_MISSES(LL)},
+	{PERF_TYPE_HW_CACHE, CACHE_MISSES(DTLB)},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS}
+};
+
+static int perf_event_open(struct perf_event_attr *attr, int group)
+{
+	return syscall(SYS_perf_event_open, attr, 0, -1, group, 0);
+}
+
+unsigned int perf_open(struct perf_group *g)
+{
+	struct perf_event_attr attr;
+	unsigned int available = 0;
+	int i;
+
+	g->leader = -1;
+	g->num_open = 0;
+
+	for (i = 0; i < PERF_COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_hv = 1;
+
+		//count the kernel's share of the job too, if we're allowed to
+		g->fds[i] = perf_event_open(&attr, g->leader);
+		if (g->fds[i] == -1 && (errno == EACCES || errno == EPERM)) {
+			attr.exclude_kernel = 1;
+			g->fds[i] = perf_event_open(&attr, g->leader);
+		}
+
+		if (g->fds[i] == -1) {
+			g->slot[i] = -1;
+			continue;
+		}
+		if (g->leader == -1)
+			g->leader = g->fds[i];
+		g->slot[i] = g->num_open++;
+		available |= 1 << i;
+	}
+
+	return available;
+}
+
+void perf_close(struct perf_group *g)
+{
+	int i;
+
+	for (i = 0; i < PERF_COUNTERS; i++)
+		if (g->slot[i] != -1)
+			close(g->fds[i]);
+	g->leader = -1;
+	g->num_open = 0;
+}
+
+/*
+ * Read every counter of the group into @counts.
+ */
+static int perf_read(struct perf_group *g, unsigned long long *counts)
+{
+	unsigned long long buf[1 + PERF_COUNTERS];
+	ssize_t size = sizeof(buf[0]) * (1 + g->num_open);
+	int i;
+
+	if (g->leader == -1 || read(g->leader, buf, size) != size)
+		return -1;
+
+	for (i = 0; i < PERF_COUNTERS; i++)
+		counts[i] = g->slot[i] == -1 ? 0 : buf[1 + g->slot[i]];
+	return 0;
+}
+
+void perf_begin(struct perf_group *g)
+{
+	if (perf_read(g, g->start))
+		memset(g->start, 0, sizeof(g->start));
+}
+
+int perf_end(struct perf_group *g, unsigned long long *counts)
+{
+	int i;
+
+	if (perf_read(g, counts))
+		return -1;
+	for (i = 0; i < PERF_COUNTERS; i++)
+		counts[i] -= g->start[i];
+	return 0;
+}
+
+void perf_clear(struct perf_stats *s)
+{
+	memset(s, 0, sizeof(struct perf_stats));
+}
+
+void perf_record(struct perf_stats *s, unsigned long long *counts)
+{
+	int i;
+
+	for (i = 0; i < PERF_COUNTERS; i++) {
+		s->total[i] += counts[i];
+		if (counts[i] > s->max[i])
+			s->max[i] = counts[i];
+	}
+	s->jobs++;
+}
+
+void perf_merge(struct perf_stats *to, struct perf_stats *from)
+{
+	int i;
+
+	for (i = 0; i < PERF_COUNTERS; i++) {
+		to->total[i] += from->total[i];
+		if (from->max[i] > to->max[i])
+			to->max[i] = from->max[i];
+	}
+	to->jobs += from->jobs;
+	to->available |= from->available;
+}
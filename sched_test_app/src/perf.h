@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef PERF_H
+#define PERF_H
+
+/*
+ * The performance counters each task thread can count its jobs with. The
+ * hardware ones need a PMU, which virtual machines often don't have, so each
+ * counter is opened on its own and left out if it can't be, and the software
+ * ones are still counted.
+ */
+#define PERF_CYCLES		0
+#define PERF_INSTRUCTIONS	1
+#define PERF_LLC_MISSES		2
+#define PERF_DTLB_MISSES	3
+#define PERF_CONTEXT_SWITCHES	4
+#define PERF_MIGRATIONS		5
+#define PERF_COUNTERS		6
+
+extern char *perf_counter_names[PERF_COUNTERS];
+
+/*
+ * The counters of one thread, read all at once as a group through leader. Only
+ * the thread which opened them may use them.
+ */
+struct perf_group {
+	int leader;		//-1 if no counter could be opened
+	int fds[PERF_COUNTERS];
+	int slot[PERF_COUNTERS];	//where each counter is in a read of the group, -1 if it wasn't opened
+	int num_open;
+	unsigned long long start[PERF_COUNTERS];	//the counts at the start of the current job
+};
+
+/*
+ * What the counters counted over the jobs of one task (or all of them).
+ */
+struct perf_stats {
+	unsigned int available;	//a bit for each counter which could be opened
+	unsigned long jobs;
+	unsigned long long total[PERF_COUNTERS];
+	unsigned long long max[PERF_COUNTERS];
+};
+
+/*
+ * Open as many of the counters for the calling thread as possible, returning
+ * a bit for each one which was.
+ */
+unsigned int perf_open(struct perf_group *g);
+void perf_close(struct perf_group *g);
+
+/*
+ * Note the counts at the start of a job, and work out how much each counter
+ * counted (0 for those which weren't opened) once it ends. perf_end returns -1
+ * if the counters couldn't be read.
+ */
+void perf_begin(struct perf_group *g);
+int perf_end(struct perf_group *g, unsigned long long *counts);
+
+void perf_clear(struct perf_stats *s);
+void perf_record(struct perf_stats *s, unsigned long long *counts);
+void perf_merge(struct perf_stats *to, struct perf_stats *from);
+
+#endif				/* PERF_H */
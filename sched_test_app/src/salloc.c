@@ -31,6 +31,10 @@
 
 #include "salloc.h"
 
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000	//older kernels take it as a plain hint
+#endif
+
 /*
  * Simple shared memory allocator for sched_test_app.
  * Note that this is not extremely efficient OR thread-safe, so it
@@ -70,11 +74,16 @@ typedef struct salloc_region {
 
 /* Total size of the area from which we're allocating */
 #define SALLOC_ALLOC_SIZE (1*1024*1024*1024)	//1GB
+/* How much of it is made usable at a time. The whole area is reserved up front,
+ * but with the memory locked every usable page is resident, so it is only
+ * opened up as it's needed. */
+#define SALLOC_CHUNK_SIZE (16*1024*1024)	//16MB
 /* The smallest we'll allow a free region to become */
 #define SALLOC_SMALLEST_REGION (_usable_size(sizeof(salloc_t)))
 
 static salloc_t *head = 0;
-static size_t total_size = 0;
+static size_t total_size = 0;	//the usable part of the area
+static size_t reserved_size = 0;
 static salloc_t *free_list = 0;
 
 #if DEBUG
@@ -169,19 +178,49 @@ static void coalesce(salloc_t * block)
 	}
 }
 
-static int increase_heap_size()
+/* Make room for an allocation of @size bytes at the end of the heap, using up
+ * the reserved area first */
+static int increase_heap_size(size_t size)
 {
-	salloc_t *new;
-	new = (salloc_t *) mmap(((char *)head) + total_size,
-				SALLOC_ALLOC_SIZE,
-				PROT_READ | PROT_WRITE,
-				MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
-	if (new == MAP_FAILED)
-		return -1;
+	salloc_t *new = (salloc_t *) (((char *)head) + total_size);
+	size_t grow = SALLOC_CHUNK_SIZE;
+
+	while (grow < size + sizeof(salloc_t))
+		grow += SALLOC_CHUNK_SIZE;
+
+	if (total_size + grow <= reserved_size) {
+		if (mprotect(new, grow, PROT_READ | PROT_WRITE))
+			return -1;
+	} else {
+		if (grow < SALLOC_ALLOC_SIZE)
+			grow = SALLOC_ALLOC_SIZE;
+		//don't map over whatever follows the heap, just fail
+		new = (salloc_t *) mmap(((char *)head) + reserved_size, grow,
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS |
+					MAP_FIXED_NOREPLACE, -1, 0);
+		if (new == MAP_FAILED)
+			return -1;
+		if (new != (salloc_t *) (((char *)head) + reserved_size)) {
+			munmap(new, grow);
+			return -1;
+		}
+		//anything left of the reserved area can't be used now
+		new = (salloc_t *) (((char *)head) + total_size);
+		grow += reserved_size - total_size;
+		if (reserved_size > total_size &&
+		    mprotect(new, reserved_size - total_size,
+			     PROT_READ | PROT_WRITE))
+			return -1;
+		reserved_size = total_size + grow;
+	}
 
-	total_size += SALLOC_ALLOC_SIZE;
-	set_size(new, SALLOC_ALLOC_SIZE);
+	total_size += grow;
+	set_size(new, grow);
 	set_free(new, 1);
+	//the new block is the last one, so it goes before head on the wrap-around
+	new->prev = head->prev;
+	head->prev = new;
 
 	if (!free_list) {
 		free_list = new;
@@ -205,16 +244,22 @@ static int increase_heap_size()
  * pointers. Returns 0 on success, -1 on failure. */
 static int init_salloc()
 {
-	//Allocate 1GB, there's no way we'll use more than that
-	head = (salloc_t *) mmap(NULL, SALLOC_ALLOC_SIZE,
-				 PROT_READ | PROT_WRITE,
-				 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	//Reserve 1GB, there's no way we'll use more than that
+	head = (salloc_t *) mmap(NULL, SALLOC_ALLOC_SIZE, PROT_NONE,
+				 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+				 -1, 0);
 	if (head == MAP_FAILED)
 		return -1;
+	if (mprotect(head, SALLOC_CHUNK_SIZE, PROT_READ | PROT_WRITE)) {
+		munmap(head, SALLOC_ALLOC_SIZE);
+		head = 0;
+		return -1;
+	}
 
-	total_size = SALLOC_ALLOC_SIZE;
+	reserved_size = SALLOC_ALLOC_SIZE;
+	total_size = SALLOC_CHUNK_SIZE;
 	free_list = head;
-	set_size(head, SALLOC_ALLOC_SIZE);
+	set_size(head, SALLOC_CHUNK_SIZE);
 	set_free(head, 1);
 	head->prev = head;
 	head->next_free = head;
@@ -238,7 +283,7 @@ static void *_salloc(size_t size, int retry)
 	/* If there are no free segments, try to allocate more */
 	if (!free_list) {
 		if (retry) {
-			if (increase_heap_size())
+			if (increase_heap_size(size))
 				return NULL;
 			else
 				return _salloc(size, retry - 1);
@@ -260,7 +305,7 @@ static void *_salloc(size_t size, int retry)
 	/* If we didn't find one, try to allocate more */
 	if (!found) {
 		if (retry) {
-			if (increase_heap_size())
+			if (increase_heap_size(size))
 				return NULL;
 			else
 				return _salloc(size, retry - 1);
@@ -30,6 +30,8 @@
 #include <chronos/chronos.h>
 
 #include "task.h"
+#include "trace.h"
+#include "live.h"
 
 /*
  * Update the locked and unlocked execution times for a task based on
@@ -51,8 +53,17 @@ void set_lock_usage(struct task *t, struct test *tester)
  */
 void calculate_releases(struct task *t, struct test *tester)
 {
-	//runtime is set to the running time of the overall test in microseconds (options->run_time is in seconds)
-	unsigned int runtime = tester->options->run_time * MILLION;
+	//runtime is set to the running time of the overall test in microseconds (options->run_time is in seconds), after the warm-up, both compressed like the periods
+	unsigned long warmup = (unsigned long)tester->options->warmup * MILLION /
+	    tester->options->compression;
+	unsigned long runtime = (unsigned long)tester->options->run_time *
+	    MILLION / tester->options->compression + warmup;
+
+	/*
+	 * Jobs released during the warm-up run while the caches and the workload's
+	 * data warm up, but aren't counted.
+	 */
+	t->warmup_releases = (warmup + t->period - 1) / t->period;
 
 	/*
 	 * The number of releases this task will have is the floor of the total runtime
@@ -60,7 +71,9 @@ void calculate_releases(struct task *t, struct test *tester)
 	 * statistics for is the highest number of tasks which will fit into the
 	 * runtime without going over it.
 	 */
-	t->max_releases = runtime / t->period;
+	t->max_releases = (long)(runtime / t->period) - t->warmup_releases;
+	if (t->max_releases < 0)
+		t->max_releases = 0;
 
 	/*
 	 * Keep track of when this division has a remainder. If it does, we set
@@ -68,36 +81,64 @@ void calculate_releases(struct task *t, struct test *tester)
 	 * other tasks have the proper amount of utility when they are finishing their
 	 * runs.
 	 */
-	t->extra_release = ((runtime % t->period) != 0);
+	t->extra_release = ((runtime % t->period) != 0 || !t->max_releases);
 }
 
 /*
  * Get the abort pointer for the current thread - what we can check periodically
- * to see if we have been aborted by the scheduler.
+ * to see if we have been aborted by the scheduler. Under the userspace backends
+ * this claims a cache line of its own for the thread.
  */
 static void setup_aborts(struct task *t)
 {
-	t->abort_pointer = get_abort_ptr(&t->tester->abort_data);
+	t->abort_pointer = register_abort_slot(&t->tester->abort_data);
 	if (!t->abort_pointer)
 		fatal_error("Failed to initialize abort pointer for task.");
 }
 
 /*
- * Find the next deadline for this task (based on the start time for all tasks,
- * this task's period, and the job number of this task) and store the result in
- * the supplied timespec struct.
+ * Find the instant the given number of this task's periods after the start time
+ * for all tasks, and store the result in the supplied timespec struct. Job
+ * number job is released at periods = job, and its deadline is at job + 1.
+ * Every release is an absolute instant, so the releases don't drift.
  */
-static void find_job_deadline(struct task *t, struct timespec *deadline)
+static void find_job_time(struct task *t, unsigned long periods,
+			  struct timespec *time)
 {
 	unsigned long long nsec, carry;
-	unsigned long offset = (t->num_releases + 1) * t->period;	//the offset from the start time this deadline is
+	unsigned long offset = periods * t->period;	//the offset from the start time this instant is
 	struct timespec *start_time = t->tester->global_start_time;	//the global start time for all tasks
 
-	nsec = start_time->tv_nsec + (unsigned long long)(offset * THOUSAND);
+	nsec = start_time->tv_nsec + (unsigned long long)offset * THOUSAND;
 	carry = nsec / BILLION;
 
-	deadline->tv_nsec = nsec % BILLION;
-	deadline->tv_sec = start_time->tv_sec + carry;
+	time->tv_nsec = nsec % BILLION;
+	time->tv_sec = start_time->tv_sec + carry;
+}
+
+/*
+ * Record how late the current job of this task started after its release, if
+ * the last job finished in time for the task to wait for it. A job which starts
+ * late because the one before it overran isn't release jitter.
+ */
+static void record_release_jitter(struct task *t)
+{
+	struct timespec release, now;
+	long long jitter;
+
+	if (!t->waited)
+		return;
+
+	chronos_clock_gettime(chronos_deadline_clock(), &now);
+	find_job_time(t, t->num_releases, &release);
+	jitter = timespec_subtract_us(&now, &release);
+	if (jitter < 0)
+		jitter = 0;
+
+	t->num_jitter++;
+	t->total_jitter += jitter;
+	if (jitter > t->max_jitter)
+		t->max_jitter = jitter;
 }
 
 /*
@@ -112,132 +153,441 @@ static void setup_hua_abort_handler(struct task *t)
 	}
 }
 
+/*
+ * Acquire the k'th of this task's locks. When the taskset gives access modes,
+ * the matching reader/writer lock is taken in that mode instead of the mutex.
+ * The time spent waiting for it is added to *blocked (in microseconds).
+ */
+static int task_lock(struct task *t, int k, unsigned long *blocked)
+{
+	struct timespec start, end;
+	chronos_rwlock_t *rw;
+	int ret;
+
+	chronos_clock_gettime(chronos_deadline_clock(), &start);
+	if (!t->tester->rw_locking) {
+		ret = chronos_mutex_lock(t->my_locks[k]);
+	} else {
+		rw = &t->tester->rwlocks[t->my_locks[k] - t->tester->locks];
+		if (t->my_lock_modes[k] == LOCK_MODE_READ)
+			ret = chronos_rwlock_rdlock(rw);
+		else
+			ret = chronos_rwlock_wrlock(rw);
+	}
+	chronos_clock_gettime(chronos_deadline_clock(), &end);
+
+	*blocked += timespec_subtract_us(&end, &start);
+	if (ret != -1)
+		trace_event(t, TRACE_LOCK, t->my_locks[k] - t->tester->locks,
+			    &end);
+	return ret;
+}
+
+/*
+ * Release the k'th of this task's locks, taken with task_lock.
+ */
+static void task_unlock(struct task *t, int k)
+{
+	trace_event(t, TRACE_UNLOCK, t->my_locks[k] - t->tester->locks, 0);
+	if (!t->tester->rw_locking)
+		chronos_mutex_unlock(t->my_locks[k]);
+	else
+		chronos_rwlock_unlock(&t->tester->rwlocks[t->my_locks[k] -
+							  t->tester->locks]);
+}
+
+/*
+ * Trace the locks taken or released all at once by task_lock_set. A lock
+ * listed twice is only taken once, so it is only traced once.
+ */
+static void trace_lock_set(struct task *t, int type, struct timespec *when)
+{
+	int i, k;
+
+	if (!t->trace)
+		return;
+	for (k = 0; k < t->num_my_locks; k++) {
+		for (i = 0; i < k && t->my_locks[i] != t->my_locks[k]; i++)
+			;
+		if (i == k)
+			trace_event(t, type, t->my_locks[k] - t->tester->locks,
+				    when);
+	}
+}
+
+/*
+ * Take every one of this task's locks at once for nested locking, or none of
+ * them if that would deadlock, as reader/writer locks in their modes when the
+ * taskset gives access modes. The time spent waiting for them is added to
+ * *blocked (in microseconds).
+ */
+static int task_lock_set(struct task *t, unsigned long *blocked)
+{
+	chronos_rwlock_t *rws[t->num_my_locks];
+	int writes[t->num_my_locks];
+	struct timespec start, end;
+	int k, ret;
+
+	chronos_clock_gettime(chronos_deadline_clock(), &start);
+	if (!t->tester->rw_locking) {
+		ret = chronos_mutex_lock_set(t->my_locks, t->num_my_locks);
+	} else {
+		for (k = 0; k < t->num_my_locks; k++) {
+			rws[k] = &t->tester->rwlocks[t->my_locks[k] -
+						     t->tester->locks];
+			writes[k] = t->my_lock_modes[k] == LOCK_MODE_WRITE;
+		}
+		ret = chronos_rwlock_lock_set(rws, writes, t->num_my_locks);
+	}
+	chronos_clock_gettime(chronos_deadline_clock(), &end);
+
+	*blocked += timespec_subtract_us(&end, &start);
+	if (ret != -1)
+		trace_lock_set(t, TRACE_LOCK, &end);
+	return ret;
+}
+
+/*
+ * Release every lock taken by task_lock_set.
+ */
+static void task_unlock_set(struct task *t)
+{
+	chronos_rwlock_t *rws[t->num_my_locks];
+	int k;
+
+	trace_lock_set(t, TRACE_UNLOCK, 0);
+	if (!t->tester->rw_locking) {
+		chronos_mutex_unlock_set(t->my_locks, t->num_my_locks);
+		return;
+	}
+
+	for (k = 0; k < t->num_my_locks; k++)
+		rws[k] = &t->tester->rwlocks[t->my_locks[k] - t->tester->locks];
+	chronos_rwlock_unlock_set(rws, t->num_my_locks);
+}
+
 /*
  * Execute the workload, lock/unlock locks, update runtime statistics, etc.
  * This function handles everything that needs to be done for a single instance
  * of a task (a job). count_stats is true if we should accrue statistics from
  * this run, and false if we are running this workload only to provide the
- * proper amount of concurrent utility while the other runs finish.
+ * proper amount of concurrent utility while the other runs finish. last is
+ * true for the final job; every other job hands straight over to the next one
+ * with next_rtseg_self, so the first job is the only one to begin its own
+ * real-time segment.
  */
-static void task_instance(struct task *t, int count_stats)
+static void task_instance(struct task *t, int count_stats, int last)
 {
-	struct timespec deadline, end_time;
+	struct timespec deadline, end_time, next_deadline;
 	long long tardiness;
+	unsigned long blocked = 0;	//microseconds this job waited for its locks
 	int aborted = 0;	//orred with the return value of the workload_do_work function calls
+	unsigned long usage = t->unlocked_usage + t->locked_usage;
+	unsigned long long counts[PERF_COUNTERS];
 
-	find_job_deadline(t, &deadline);	//find the deadline for this taskset
+	if (count_stats)
+		record_release_jitter(t);
 
-	setup_hua_abort_handler(t);
+	if (t->trace) {
+		struct timespec release;
+
+		find_job_time(t, t->num_releases, &release);
+		trace_event(t, TRACE_RELEASE, 0, &release);
+		trace_event(t, TRACE_BEGIN, 0, 0);
+	}
+
+	if (t->tester->options->perf_counters)
+		perf_begin(&t->perf_group);
 
-	begin_rtseg_self(TASK_RUN_PRIO, t->utility, &deadline, &t->period_ts, t->unlocked_usage + t->locked_usage);	//enter real-time segment
+	find_job_time(t, t->num_releases + 1, &deadline);	//find the deadline for this taskset
+
+	if (t->num_releases == 0) {
+		setup_hua_abort_handler(t);
+		begin_rtseg_self(TASK_RUN_PRIO, t->utility, &deadline, &t->period_ts, usage);	//enter real-time segment
+	}
 
 	if (t->tester->options->locking & NESTED_LOCKING) {	//do nested locking, if applicable
-		int last, lock_num;
-		for (lock_num = 0; lock_num < t->num_my_locks; lock_num++) {
-			if (chronos_mutex_lock(t->my_locks[lock_num]) == -1)
-				break;
-			else
-				last = lock_num;
-		}
+		//take the whole set at once (or none of it, if that would deadlock)
+		int locked = !task_lock_set(t, &blocked);
 
 		aborted |= workload_do_work(t, t->locked_usage);
 
-		for (lock_num = last; lock_num >= 0; lock_num--) {
-			chronos_mutex_unlock(t->my_locks[lock_num]);
-		}
+		if (locked)
+			task_unlock_set(t);
 
 	} else if (t->tester->options->locking & LOCKING) {	//do non-nested locking, if applicable
 		int lock_num;
 		for (lock_num = 0; lock_num < t->num_my_locks; lock_num++) {
-			if (chronos_mutex_lock(t->my_locks[lock_num]) == -1)
+			if (task_lock(t, lock_num, &blocked) == -1)
 				break;
 			aborted |= workload_do_work(t, t->locked_usage);
-			chronos_mutex_unlock(t->my_locks[lock_num]);
+			task_unlock(t, lock_num);
 		}
 	}
 
 	aborted |= workload_do_work(t, t->unlocked_usage);	//do unlocked workload time
 
-	clock_gettime(CLOCK_REALTIME, &end_time);	//get the endtime
+	chronos_clock_gettime(chronos_deadline_clock(), &end_time);	//get the endtime
 
-	end_rtseg_self(TASK_CLEANUP_PRIO);	//end the real-time segment
+	//what the performance counters counted over the job
+	if (t->tester->options->perf_counters &&
+	    !perf_end(&t->perf_group, counts)) {
+		if (count_stats)
+			perf_record(&t->perf, counts);
+		trace_counters(t, t->perf.available, counts, &end_time);
+	}
+
+	tardiness = timespec_subtract_us(&deadline, &end_time);	//calculate tardiness from deadline and endtime
+
+	trace_event(t, TRACE_END, (aborted ? TRACE_END_ABORTED : 0) |
+		    (count_stats ? TRACE_END_COUNTED : 0) |
+		    (!aborted && tardiness >= 0 ? TRACE_END_MET : 0), &end_time);
 
 	/*
 	 * Is this run for the sole purpose of making sure the other 'real' runs have
-	 * the appropriate amount of concurrent utility? If it is, return and don't
-	 * count the statistics for this run.
+	 * the appropriate amount of concurrent utility? If it is, don't count the
+	 * statistics for this run.
 	 */
-	if (!count_stats)
-		return;
+	if (count_stats) {
+		t->num_counted++;
+		t->total_blocking += blocked;
+		if (blocked > t->max_blocking)
+			t->max_blocking = blocked;
+	}
 
-	tardiness = timespec_subtract_us(&deadline, &end_time);	//calculate tardiness from deadline and endtime
+	//a job which completed adds to the distributions of response time and lateness
+	if (count_stats && !aborted) {
+		struct timespec release;
+
+		find_job_time(t, t->num_releases, &release);
+		hist_record(&t->response,
+			    timespec_subtract_us(&end_time, &release));
+		hist_record(&t->lateness, -tardiness);
+	}
+
+	if (count_stats && aborted) {	//have we been aborted?
+		long long aborted_at = get_abort_time(&t->tester->abort_data);
 
-	//tabulate statistics about this run
-	if (aborted) {		//have we been aborted?
 		t->num_aborted++;
-	} else if (tardiness >= 0) {	//otherwise, did we meet our deadline?
+
+		//how long it took us to stop, if the backend noted when it aborted us
+		if (aborted_at) {
+			unsigned long latency =
+			    ((long long)end_time.tv_sec * BILLION + end_time.tv_nsec -
+			     aborted_at) / THOUSAND;
+			t->num_abort_latency++;
+			t->total_abort_latency += latency;
+			if (latency > t->max_abort_latency)
+				t->max_abort_latency = latency;
+		}
+	} else if (count_stats && tardiness >= 0) {	//otherwise, did we meet our deadline?
 		t->deadlines_met++;	//increment deadlines_met, if we met ours
 		t->utility_accrued += t->utility;	//add to utility_accrued however much we accrued
-		//sleep for however much time remains before the next release of this task
-		if (tardiness > 0)
-			usleep(tardiness);
-	} else {		//if we got here, we blew our deadline?
+	} else if (count_stats) {	//if we got here, we blew our deadline?
 		//figure out if our tardiness was worse than anyone else's so far
 		if (tardiness < t->max_tardiness)	//this is reverse from what it ought to be
 			t->max_tardiness = tardiness;
 	}
-	//TODO maybe keep a figure on average tardiness? (would this be useful?)
+
+	live_update_task(t);
+
+	if (last) {
+		end_rtseg_self(TASK_CLEANUP_PRIO);	//end the real-time segment
+		return;
+	}
+
+	/*
+	 * The next release is this job's deadline. A job which finished before it
+	 * (even an aborted one) sleeps until then; a late one wakes straight away.
+	 */
+	t->waited = tardiness > 0;
+	find_job_time(t, t->num_releases + 2, &next_deadline);
+	setup_hua_abort_handler(t);
+	next_rtseg_self(TASK_CLEANUP_PRIO, TASK_RUN_PRIO, t->utility, &deadline,
+			&next_deadline, &t->period_ts, usage);
 }
 
 /*
- * The function called from pthread_create to start a task. This function is
- * ultimately responsible for entering and exiting real-time segments, calling
- * the appropriate workload for the correct amount of time, and leaving the
- * segment, then recording scheduling statistics.
+ * Half the width of the 95% Wilson score interval of a proportion @p measured
+ * over @n trials. Unlike the normal approximation, it doesn't collapse to
+ * nothing when every deadline is met.
  */
-void *start_task(void *arg)
+static double wilson_half_width(double p, double n)
 {
-	struct sched_param param;
-	struct task *t = (struct task *)arg;
+	double z = 1.96;
 
-	//do some initialization before we actually signal we're ready to start our real-time task
-	t->thread_id = gettid();	//get our thread's tid
-	setup_aborts(t);	//grab our pointer which we can query to make sure we're not aborted yet
+	return z / (1 + z * z / n) * sqrt(p * (1 - p) / n + z * z / (4 * n * n));
+}
 
-	//set the affinity of this thread to whatever was specified in the taskset file
-	if (sched_setaffinity(0, sizeof(t->cpu_mask),
-			      (cpu_set_t *) & t->cpu_mask))
-		fatal_error("Failed to set processor affinity of a task.");
+/*
+ * Decide whether the deadline satisfaction and accrued utility ratios over the
+ * jobs counted so far, by all the tasks, are known closely enough to end the
+ * run. The accrued utility ratio weighs each job by its utility, so it counts
+ * as fewer, equally weighted, trials. Every task must have had a job counted,
+ * so that long periods aren't left out.
+ */
+#define MIN_CONVERGED_JOBS 30
 
-	workload_init_task(t);	//initialize any local data the workload needs
+static int stats_converged(struct test *tester)
+{
+	double jobs = 0, met = 0, util = 0, util_met = 0, util_sq = 0;
+	double target = tester->options->confidence / 100;
+	int i;
+
+	for (i = 0; i < tester->num_tasks; i++) {
+		struct task *t = tester->tasks[i];
+		double n = t->num_counted;
+
+		if (!n)
+			return 0;
+		jobs += n;
+		met += t->deadlines_met;
+		util += n * t->utility;
+		util_met += t->utility_accrued;
+		util_sq += n * t->utility * t->utility;
+	}
+
+	if (jobs < MIN_CONVERGED_JOBS)
+		return 0;
+	if (wilson_half_width(met / jobs, jobs) > target)
+		return 0;
+	return !util || wilson_half_width(util_met / util,
+					  util * util / util_sq) <= target;
+}
+
+/*
+ * Wait at the shared @barrier along with every other task and the main
+ * process. The tasks of a group gather at their group's barrier first, so only
+ * the group leaders wait at the shared one, and the wake-up fans back out
+ * through the groups.
+ */
+static void group_barrier_wait(struct task *t, pthread_barrier_t *barrier)
+{
+	pthread_barrier_t *group = &t->group_leader->group_barrier;
+
+	pthread_barrier_wait(group);
+	if (group_leader(t))
+		pthread_barrier_wait(barrier);
+	pthread_barrier_wait(group);
+}
+
+/*
+ * Do one run of a task: all of its releases, from registering with the backend
+ * to unregistering again. This is ultimately responsible for entering and
+ * exiting real-time segments, calling the appropriate workload for the correct
+ * amount of time, and leaving the segment, then recording scheduling
+ * statistics.
+ */
+static void run_task(struct task *t)
+{
+	struct sched_param param;
+	struct chronos_thread_schedstat sched_start, sched_end;
+	unsigned int end;
+
+	setup_aborts(t);	//grab our pointer which we can query to make sure we're not aborted yet
 
 	//increase priority to TASK_START_PRIO
 	param.sched_priority = TASK_START_PRIO;
 	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
 
-	pthread_barrier_wait(t->tester->barrier);	//wait on the barrier for all threads to arrive
+	//let the backend know about us before anyone can start
+	if (chronos_task_register())
+		fatal_error("Failed to register a task with libchronos.");
+
+	if (t->tester->options->perf_counters)
+		t->perf.available = perf_open(&t->perf_group);
+
+	//what the scheduler counts for our thread from here to the end of the run
+	t->sched_valid = !chronos_thread_schedstat(0, &sched_start);
+
+	//wait for all threads (and the main process) to arrive, and again while
+	//the main process sets the start time
+	group_barrier_wait(t, t->tester->barrier);
+	group_barrier_wait(t, t->tester->barrier);
+
+	//sleep until the start time, and see how late we woke up
+	if (chronos_clock_nanosleep(chronos_deadline_clock(), TIMER_ABSTIME,
+				    t->tester->global_start_time))
+		fatal_error("Failed to sleep until the start time.");
+	chronos_clock_gettime(chronos_deadline_clock(), &t->local_start_time);
+	t->start_skew = timespec_subtract_us(&t->local_start_time,
+					     t->tester->global_start_time);
+	t->waited = 1;
 
-	//get the start time and CAS on the start-time so all the threads agree on when they got here
-	clock_gettime(CLOCK_REALTIME, &t->local_start_time);
-	//Note: the next line is a gcc-specific CAS extension. This is NOT portable to a different compiler. (FIXME?)
-	__sync_bool_compare_and_swap(&t->tester->global_start_time, 0,
-				     &t->local_start_time);
+	//the warm-up releases aren't counted
+	for (t->num_releases = 0; t->num_releases < t->warmup_releases;
+	     t->num_releases++)
+		task_instance(t, 0, 0);
 
 	/* for each release of this task, call task_instance to do the heavy-lifting
 	 * (actually execute the workload, lock/unlock locks, update runtime
 	 * statistics, etc.)
 	 */
-	for (t->num_releases = 0; t->num_releases < t->max_releases;
-	     t->num_releases++)
-		task_instance(t, 1 /*count the statistics for this run */ );
+	end = t->warmup_releases + t->max_releases;
+	for (; t->num_releases < end && !*t->tester->converged;
+	     t->num_releases++) {
+		task_instance(t, 1 /*count the statistics for this run */ ,
+			      !t->extra_release && t->num_releases + 1 == end);
+		if (t->tester->options->confidence &&
+		    stats_converged(t->tester))
+			*t->tester->converged = 1;
+	}
 
 	/*
 	 * Run the task one period after it technically hit its last one, but don't
 	 * measure the statistics. This makes sure all other tasks get the full load
-	 * for all of their periods.
+	 * for all of their periods. The same goes for a run which ends early
+	 * because the statistics have converged.
 	 */
-	if (t->extra_release)
-		task_instance(t, 0 /*DON'T count the statistics */ );
+	if (t->extra_release || t->num_releases < end)
+		task_instance(t, 0 /*DON'T count the statistics */ , 1);
+
+	if (t->tester->options->perf_counters)
+		perf_close(&t->perf_group);
+	if (t->sched_valid && !chronos_thread_schedstat(0, &sched_end))
+		chronos_thread_schedstat_diff(&t->sched, &sched_start,
+					      &sched_end);
+	else
+		t->sched_valid = 0;
+	chronos_task_unregister();
+	unregister_abort_slot(&t->tester->abort_data);
+	t->abort_pointer = 0;
+}
+
+/*
+ * The function called from pthread_create to start a task. This sets the task
+ * up, then does one run of it, or every run of the batch if the task groups
+ * stay alive between runs.
+ */
+void *start_task(void *arg)
+{
+	struct task *t = (struct task *)arg;
+	struct run_control *control = t->tester->control;
+
+	//do some initialization before we actually signal we're ready to start our real-time task
+	t->thread_id = gettid();	//get our thread's tid
+
+	//set the affinity of this thread to whatever was specified in the taskset file
+	if (sched_setaffinity(0, sizeof(t->cpu_mask),
+			      (cpu_set_t *) & t->cpu_mask))
+		fatal_error("Failed to set processor affinity of a task.");
+
+	workload_init_task(t);	//initialize any local data the workload needs
+
+	if (!control)
+		run_task(t);
+
+	/*
+	 * If we stay alive for the whole batch, do every run the main process
+	 * sets us up for.
+	 */
+	while (control) {
+		group_barrier_wait(t, &control->start);
+		if (control->quit)
+			break;
+		run_task(t);
+		group_barrier_wait(t, &control->done);
+	}
 
 	workload_cleanup_task(t);	//clean up any local data for the workload
 
@@ -250,34 +600,38 @@ void *start_task(void *arg)
  */
 int start_task_group(void *arg)
 {
-	int i;
 	struct task *t = (struct task *)arg;
-	struct test *tester = t->tester;
+	struct task *curr;
+	int stack_kb = t->tester->options->stack_kb;
+	pthread_attr_t attr;
 
 	workload_init_group(t);	//initialize the group-specific workload data for this group
 
+	if (pthread_barrier_init(&t->group_barrier, NULL, t->group_size))
+		fatal_error("Failed to initialize a task group barrier.");
+
+	//every thread's stack is locked in memory, so keep them small
+	pthread_attr_init(&attr);
+	if (stack_kb && pthread_attr_setstacksize(&attr, stack_kb * 1024L))
+		fatal_error("Failed to set the stack size of the task threads.");
+
 	//start all the other threads in our group
-	for (i = 0; i < tester->num_tasks; i++) {
-		if (same_group(t, tester->tasks[i])
-		    && !group_leader(tester->tasks[i]))
-			if (pthread_create(&tester->tasks[i]->thread.p, NULL,
-					   start_task,
-					   (void *)tester->tasks[i]))
-				fatal_error("Failed to pthread_create "
-					    "one of the task group threads.");
-	}
+	for (curr = t->next_in_group; curr; curr = curr->next_in_group)
+		if (pthread_create(&curr->thread.p, &attr, start_task,
+				   (void *)curr))
+			fatal_error("Failed to pthread_create "
+				    "one of the task group threads.");
+	pthread_attr_destroy(&attr);
 
 	start_task(arg);
 
 	//wait until the other threads in our group are done
-	for (i = 0; i < tester->num_tasks; i++) {
-		if (same_group(t, tester->tasks[i])
-		    && !group_leader(tester->tasks[i]))
-			if (pthread_join(tester->tasks[i]->thread.p, NULL))
-				fatal_error("Failed to pthread_join "
-					    "one of the task group threads.");
-	}
+	for (curr = t->next_in_group; curr; curr = curr->next_in_group)
+		if (pthread_join(curr->thread.p, NULL))
+			fatal_error("Failed to pthread_join "
+				    "one of the task group threads.");
 
+	pthread_barrier_destroy(&t->group_barrier);
 	workload_cleanup_group(t);	//clean up the group-specific workload data for this group
 
 	return 0;
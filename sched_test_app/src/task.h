@@ -38,6 +38,7 @@ static inline void ill_formed_taskset_file()
 
 void init_task(struct test *tester, FILE * f);
 void init_group(struct test *tester, FILE * f);
+void cleanup_group_table(struct test *tester);
 void set_lock_usage(struct task *t, struct test *tester);
 void calculate_releases(struct task *t, struct test *tester);
 void *start_task(void *arg);	//function passed to pthread_create
@@ -23,8 +23,6 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
-#include <assert.h>
-
 #include "task.h"
 #include "salloc.h"
 
@@ -108,6 +106,8 @@ static void initialize_task_cpus(struct test *tester, struct task *t,
 /*
  * Given a comma-separated list in string locks[], initalize this task's locks
  * array to point to those locks in the global locks list to which they refer.
+ * Each lock may be followed by 'r' or 'w' to take it for reading or writing;
+ * locks without a mode are taken for writing.
  */
 static void initialize_task_locks(struct test *tester, struct task *t,
 				  char locks[])
@@ -121,7 +121,8 @@ static void initialize_task_locks(struct test *tester, struct task *t,
 	t->my_locks =
 	    (chronos_mutex_t **) salloc(sizeof(chronos_mutex_t *) *
 					tester->num_locks);
-	if (!t->my_locks)
+	t->my_lock_modes = (char *)salloc(sizeof(char) * tester->num_locks);
+	if (!t->my_locks || !t->my_lock_modes)
 		fatal_error("Failed to allocate memory.");
 
 	/*
@@ -129,8 +130,10 @@ static void initialize_task_locks(struct test *tester, struct task *t,
 	 */
 	if (locks[0] == 'a' && locks[1] == 'l' && locks[2] == 'l') {
 		t->num_my_locks = tester->num_locks;
-		for (i = 0; i < tester->num_locks; i++)
+		for (i = 0; i < tester->num_locks; i++) {
 			t->my_locks[i] = &tester->locks[i];
+			t->my_lock_modes[i] = LOCK_MODE_WRITE;
+		}
 		return;
 	}
 
@@ -150,6 +153,14 @@ static void initialize_task_locks(struct test *tester, struct task *t,
 		//read the lock as an integer, and get the pointer to the global locks array
 		lock_no = atoi(tmp);
 		t->my_locks[t->num_my_locks] = &tester->locks[lock_no];
+		t->my_lock_modes[t->num_my_locks] = LOCK_MODE_WRITE;
+
+		//an access mode, if given, follows the lock number
+		if (l[j - 1] == LOCK_MODE_READ || l[j - 1] == LOCK_MODE_WRITE) {
+			t->my_lock_modes[t->num_my_locks] = l[j - 1];
+			tester->rw_locking = 1;
+			j++;
+		}
 		t->num_my_locks++;
 
 		//if the bad character wasn't a comma, we're done here
@@ -165,28 +176,88 @@ static void set_period_ts(struct task *t)
 	    t->period * THOUSAND - t->period_ts.tv_sec * MILLION * THOUSAND;
 }
 
+/*
+ * Find the slot of the hash table of group leaders where the leader of the
+ * given thread group is, or would go. The table is kept at most half full, so
+ * there's always an empty slot to stop at.
+ */
+static struct task **group_slot(struct test *tester, unsigned int group)
+{
+	unsigned int i = (group * 2654435761u) & (tester->group_table_size - 1);
+
+	while (tester->group_table[i] &&
+	       tester->group_table[i]->thread_group != group)
+		i = (i + 1) & (tester->group_table_size - 1);
+	return &tester->group_table[i];
+}
+
+/*
+ * Double the size of the hash table of group leaders (or create it).
+ */
+static void grow_group_table(struct test *tester)
+{
+	struct task **old = tester->group_table;
+	unsigned int i, old_size = tester->group_table_size;
+
+	tester->group_table_size = old_size ? old_size * 2 : 64;
+	tester->group_table =
+	    (struct task **)calloc(tester->group_table_size,
+				   sizeof(struct task *));
+	if (!tester->group_table)
+		fatal_error("Failed to allocate memory.");
+
+	for (i = 0; i < old_size; i++)
+		if (old[i])
+			*group_slot(tester, old[i]->thread_group) = old[i];
+	free(old);
+}
+
+/*
+ * Find the leader of the given thread group, or NULL if none of its tasks has
+ * been read yet.
+ */
+static struct task *find_group_leader(struct test *tester, unsigned int group)
+{
+	if (!tester->group_table)
+		return NULL;
+	return *group_slot(tester, group);
+}
+
 /*
  * Initialize the thread group leader (task->group_leader) for this task.
  * If we are the first task to be read in from the taskset file in this group,
- * we're the leader. Otherwise, find another task in our group and
- * update our pointer to point to the leader.
+ * we're the leader. Otherwise, join the list of tasks our group's leader
+ * heads.
  */
 static void init_group_leader(struct test *tester, struct task *task)
 {
-	struct task *curr = tester->task_list;
-	assert(curr);
+	struct task *leader = find_group_leader(tester, task->thread_group);
 
-	while (curr) {
-		if (curr != task && same_group(curr, task)) {
-			assert(curr->group_leader);
-			task->group_leader = curr->group_leader;
-			return;
-		}
-		curr = curr->next;
+	if (leader) {
+		task->group_leader = leader;
+		task->next_in_group = leader->next_in_group;
+		leader->next_in_group = task;
+		leader->group_size++;
+		return;
 	}
 
 	//If noone else is the group leader for our task group, make us the leader
+	if ((tester->num_groups + 1) * 2 > tester->group_table_size)
+		grow_group_table(tester);
+	*group_slot(tester, task->thread_group) = task;
 	task->group_leader = task;
+	task->group_size = 1;
+	tester->num_groups++;
+}
+
+/*
+ * Free the hash table of group leaders once the taskset has been read.
+ */
+void cleanup_group_table(struct test *tester)
+{
+	free(tester->group_table);
+	tester->group_table = 0;
+	tester->group_table_size = 0;
 }
 
 /*
@@ -210,6 +281,13 @@ void init_task(struct test *tester, FILE * f)
 			    "missing one or more required fields for task "
 			    "(number of allowed cpus, thread group, task WSS, period in us, execution time in us, and task utility).");
 
+	//compress the task's time scale along with the run's
+	t->period /= tester->options->compression;
+	t->exec_time /= tester->options->compression;
+	if (tester->options->compression > 1 && (!t->period || !t->exec_time))
+		fatal_error("The time compression factor leaves a task "
+			    "without a period or execution time.");
+
 	//ensure the WSS is within the bounds of what we allow
 	if (!(tester->workload->capabilities & WORKLOAD_CAP_TASK_WSS))
 		t->task_wss = 0;
@@ -271,7 +349,7 @@ void init_group(struct test *tester, FILE * f)
 {
 	int num_fields, thread_group;
 	long group_wss;
-	struct task *curr;
+	struct task *leader;
 
 	//read the fields in from the taskset file
 	num_fields = fscanf(f, "%d %ld ", &thread_group, &group_wss);
@@ -287,17 +365,10 @@ void init_group(struct test *tester, FILE * f)
 	else if (group_wss > tester->workload->max_group_wss)
 		group_wss = tester->workload->max_group_wss;
 
-	//search for the group_leader for this thread group, and add this information to its struct
-	curr = tester->task_list;
-	while (curr) {
-		if (group_leader(curr) && curr->thread_group == thread_group) {
-			curr->group_wss = group_wss;
-			return;
-		}
-		curr = curr->next;
-	}
-
-	//if we didn't return by now, we haven't found this task's group leader
-	fatal_error("Ill-formed taskset file: "
-		    "group line specifies empty group (i.e. no tasks are in it).");
+	//look up the group_leader for this thread group, and add this information to its struct
+	leader = find_group_leader(tester, thread_group);
+	if (!leader)
+		fatal_error("Ill-formed taskset file: "
+			    "group line specifies empty group (i.e. no tasks are in it).");
+	leader->group_wss = group_wss;
 }
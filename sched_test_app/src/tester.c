@@ -23,11 +23,18 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 
 #include "tester.h"
 #include "salloc.h"
 #include "hardware.h"
+#include "analysis.h"
+#include "trace.h"
+#include "live.h"
 
 /*
  * This is the one copy of the test struct which gets passed around everywhere
@@ -41,12 +48,28 @@ static struct test tester = {
 	.tasks = 0,
 	.num_tasks = 0,
 	.locks = 0,
+	.rwlocks = 0,
 	.num_locks = -1,
+	.rw_locking = 0,
 	.num_processors = 0,
 	.domain_masks = 0,
-	.global_start_time = 0
+	.main_cpu = 0,
+	.global_start_time = 0,
+	.control = 0
 };
 
+/*
+ * The scheduler's statistics as they were when the last run started, and what
+ * it counted over that run.
+ */
+static struct chronos_schedstat schedstat_start, schedstat_run;
+static int schedstat_valid;
+
+/*
+ * Shared memory for task groups which stay alive for a whole batch.
+ */
+static struct run_control *batch_control;
+
 /*
  * Initialize all the locks for the taskset.
  */
@@ -56,10 +79,15 @@ static void initialize_test_locks()
 	tester.locks =
 	    (chronos_mutex_t *) salloc(sizeof(chronos_mutex_t) *
 				       tester.num_locks);
-	if (!tester.locks)
+	tester.rwlocks =
+	    (chronos_rwlock_t *) salloc(sizeof(chronos_rwlock_t) *
+					tester.num_locks);
+	if (!tester.locks || !tester.rwlocks)
 		fatal_error("Failed to allocate memory.");
-	for (i = 0; i < tester.num_locks; i++)
+	for (i = 0; i < tester.num_locks; i++) {
 		chronos_mutex_init(&tester.locks[i]);
+		chronos_rwlock_init(&tester.rwlocks[i]);
+	}
 
 	if (tester.num_locks && !(tester.options->locking & LOCKING))
 		warning("Locking not enabled, "
@@ -75,8 +103,11 @@ static void initialize_test_locks()
 static void cleanup_test_locks()
 {
 	sfree(tester.locks);
+	sfree(tester.rwlocks);
 	tester.locks = 0;
+	tester.rwlocks = 0;
 	tester.num_locks = 0;
+	tester.rw_locking = 0;
 }
 
 /*
@@ -144,6 +175,7 @@ static void init_tasks(char *taskset_filename)
 	}
 
 	fclose(f);
+	cleanup_group_table(&tester);
 
 	if (tester.num_locks < 0)
 		fatal_error("Number of locks not found in taskset file.");
@@ -151,6 +183,17 @@ static void init_tasks(char *taskset_filename)
 	if (tester.num_tasks <= 0)
 		fatal_error("No tasks found in taskset file");
 
+	//the instant every task starts its first job at, set before each run
+	tester.global_start_time =
+	    (struct timespec *)salloc(sizeof(struct timespec));
+	if (!tester.global_start_time)
+		fatal_error("Failed to allocate memory.");
+
+	//the flag which ends a run early once its statistics have converged
+	tester.converged = (int *)salloc(sizeof(int));
+	if (!tester.converged)
+		fatal_error("Failed to allocate memory.");
+
 	//create an array from the task list so access to the tasks is constant-time
 	tester.tasks =
 	    (struct task **)salloc(sizeof(struct task *) * tester.num_tasks);
@@ -164,10 +207,6 @@ static void init_tasks(char *taskset_filename)
 		curr = curr->next;
 		i++;
 	}
-
-	//initialize the abort device
-	if (init_aborts(&tester.abort_data))
-		fatal_error("Failed to initialize abort device.");
 }
 
 static void cleanup_tasks()
@@ -176,16 +215,23 @@ static void cleanup_tasks()
 
 	sfree(tester.domain_masks);
 	tester.domain_masks = 0;
+	sfree(tester.converged);
+	tester.converged = 0;
+	sfree(tester.global_start_time);
+	tester.global_start_time = 0;
 
 	for (i = 0; i < tester.num_tasks; i++) {
 		if (tester.tasks[i]->my_locks)
 			sfree(tester.tasks[i]->my_locks);
+		if (tester.tasks[i]->my_lock_modes)
+			sfree(tester.tasks[i]->my_lock_modes);
 		sfree(tester.tasks[i]);
 	}
 	tester.task_list = 0;
 	sfree(tester.tasks);
 	tester.tasks = 0;
 	tester.num_tasks = 0;
+	tester.num_groups = 0;
 }
 
 /*
@@ -199,6 +245,19 @@ static void clear_counters()
 	tester.sys_met_util = 0;
 	tester.sys_abort_count = 0;
 	tester.max_tardiness = 0;
+	hist_clear(&tester.sys_response);
+	hist_clear(&tester.sys_lateness);
+	tester.sys_num_jitter = 0;
+	tester.sys_total_jitter = 0;
+	tester.max_jitter = 0;
+	tester.sys_total_blocking = 0;
+	tester.max_blocking = 0;
+	tester.sys_num_abort_latency = 0;
+	tester.sys_total_abort_latency = 0;
+	tester.max_abort_latency = 0;
+	tester.sys_total_skew = 0;
+	tester.max_skew = 0;
+	perf_clear(&tester.sys_perf);
 }
 
 /*
@@ -276,24 +335,483 @@ void calc_lock_time()
 	sched_setscheduler(0, SCHED_OTHER, &param);
 }
 
+/*
+ * Set up the correct scheduler on all the domains we need.
+ */
+static void set_schedulers()
+{
+	int i;
+
+	for (i = 0; i < tester.num_processors &&
+	     tester.domain_masks[i] != 0; i++) {
+		if (set_scheduler(get_scheduler(tester.options),
+				  get_priority(tester.options),
+				  tester.domain_masks[i])) {
+			if (errno == ENOSYS)
+				fatal_error("This kernel doesn't have the ChronOS "
+					    "system calls. Use \"-k sim\" to "
+					    "run in simulated time, or \"-k user\" "
+					    "to schedule on SCHED_FIFO.");
+			if (tester.options->backend == CHRONOS_BACKEND_DEADLINE)
+				fatal_error("SCHED_DEADLINE can only run EDF.");
+			fatal_error("Selection of RT scheduler failed! "
+				    "Is the scheduler loaded?");
+		}
+	}
+}
+
+/*
+ * Time empty jobs of a real-time task on the first domain, each with as many
+ * lock round trips as the task holding the most locks and the clock reads of
+ * a job, and store the average time one took in nanoseconds (or 0 if the
+ * backend wouldn't run them).
+ */
+static void *get_job_overhead(void *p)
+{
+	unsigned long *overhead = (unsigned long *)p;
+	struct timespec deadline, period = { 1, 0 }, start_time, end_time;
+	struct sched_param param;
+	chronos_mutex_t r;
+	clockid_t clock = chronos_deadline_clock();
+	int i, k, num_locks = 0;
+
+	*overhead = 0;
+
+	param.sched_priority = TASK_RUN_PRIO;
+	sched_setscheduler(0, SCHED_FIFO, &param);
+	if (sched_setaffinity(0, sizeof(tester.domain_masks[0]),
+			      (cpu_set_t *) & tester.domain_masks[0]))
+		return NULL;
+
+	if (tester.options->locking)
+		for (i = 0; i < tester.num_tasks; i++)
+			if (tester.tasks[i]->num_my_locks > num_locks)
+				num_locks = tester.tasks[i]->num_my_locks;
+
+	chronos_mutex_init(&r);
+	if (chronos_task_register()) {
+		chronos_mutex_destroy(&r);
+		return NULL;
+	}
+
+	chronos_clock_gettime(clock, &start_time);
+	for (i = 0; i < OVERHEAD_JOBS; i++) {
+		chronos_clock_gettime(clock, &deadline);
+		deadline.tv_sec++;
+		if (begin_rtseg_self(TASK_RUN_PRIO, 1, &deadline, &period, 0))
+			break;
+		for (k = 0; k < num_locks; k++) {
+			chronos_mutex_lock(&r);
+			chronos_mutex_unlock(&r);
+		}
+		chronos_clock_gettime(clock, &end_time);
+		end_rtseg_self(TASK_CLEANUP_PRIO);
+	}
+	chronos_clock_gettime(clock, &end_time);
+
+	chronos_task_unregister();
+	chronos_mutex_destroy(&r);
+
+	if (i == OVERHEAD_JOBS)
+		*overhead = timespec_subtract_ns(&start_time, &end_time) / i;
+	return NULL;
+}
+
+/*
+ * Check that compressing time by the factor asked for leaves the per-job
+ * overhead a negligible part of the shortest job, and print the bound on it.
+ * Simulated time has no overhead to speak of.
+ */
+static void check_compression()
+{
+	struct sched_param param;
+	pthread_t t1;
+	unsigned long overhead, shortest = 0;
+	double percent;
+	int i, prio;
+
+	if (tester.options->compression == 1)
+		return;
+
+	if (tester.options->backend == CHRONOS_BACKEND_SIM) {
+		if (tester.options->output_format == OUTPUT_LOG ||
+		    tester.options->output_format == OUTPUT_VERBOSE)
+			printf("Time compression: %dx, in simulated time\n",
+			       tester.options->compression);
+		return;
+	}
+
+	//the jobs are only as short as the lowest usage makes them
+	for (i = 0; i < tester.num_tasks; i++) {
+		unsigned long exec = tester.tasks[i]->exec_time *
+		    tester.options->cpu_usage / 100;
+		if (!shortest || exec < shortest)
+			shortest = exec;
+	}
+	if (!shortest)
+		fatal_error("The time compression factor leaves a job "
+			    "with no execution time.");
+
+	prio = getpriority(PRIO_PROCESS, 0);
+	param.sched_priority = MAIN_PRIO;
+	sched_setscheduler(0, SCHED_FIFO, &param);
+	set_schedulers();
+
+	if (pthread_create(&t1, NULL, get_job_overhead, &overhead) ||
+	    pthread_join(t1, NULL))
+		fatal_error("Failed to measure the per-job overhead.");
+
+	param.sched_priority = prio;
+	sched_setscheduler(0, SCHED_OTHER, &param);
+
+	if (!overhead)
+		fatal_error("Failed to measure the per-job overhead.");
+
+	percent = (double)overhead / THOUSAND * 100 / shortest;
+	if (tester.options->output_format == OUTPUT_LOG ||
+	    tester.options->output_format == OUTPUT_VERBOSE)
+		printf("Time compression: %dx, per-job overhead %lu nsec, "
+		       "at most %.2f%% of a job\n", tester.options->compression,
+		       overhead, percent);
+	if (percent > MAX_COMPRESSION_OVERHEAD) {
+		printf("Error: At %dx, the per-job overhead is %.2f%% of the "
+		       "shortest job, more than the %d%% allowed.\n",
+		       tester.options->compression, percent,
+		       MAX_COMPRESSION_OVERHEAD);
+		exit(1);
+	}
+}
+
+/*
+ * Print the overhead of the userspace dispatcher during the last run.
+ */
+static void print_dispatch_stats()
+{
+	struct chronos_dispatch_stats stats;
+
+	//the partitions of a batch share one dispatcher, so its stats are mixed
+	if (tester.options->partitions > 1)
+		return;
+
+	if (chronos_get_dispatch_stats(&stats) || !stats.events)
+		return;
+
+	printf("Dispatcher: %llu events, %llu priority changes, "
+	       "avg %llu nsec, max %llu nsec\n", stats.events,
+	       stats.prio_changes, stats.total_ns / stats.events,
+	       stats.max_ns);
+}
+
+/*
+ * The memory a task keeps locked while it runs, in bytes: its stack, its
+ * working set, and its share of the shared memory. A group leader also holds
+ * its group's working set.
+ */
+static unsigned long task_memory(struct task *t)
+{
+	unsigned long bytes = sizeof(struct task);
+	struct rlimit stack;
+
+	if (tester.options->stack_kb)
+		bytes += tester.options->stack_kb * 1024UL;
+	else if (!getrlimit(RLIMIT_STACK, &stack) &&
+		 stack.rlim_cur != RLIM_INFINITY)
+		bytes += stack.rlim_cur;
+
+	if (t->my_locks)
+		bytes += tester.num_locks * (sizeof(chronos_mutex_t *) +
+					     sizeof(char));
+	if (t->task_wss > 0)
+		bytes += t->task_wss;
+	if (group_leader(t) && t->group_wss > 0)
+		bytes += t->group_wss;
+
+	return bytes;
+}
+
+/*
+ * Print how much memory the taskset keeps locked, in all and for each task.
+ */
+static void print_memory()
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < tester.num_tasks; i++)
+		total += task_memory(tester.tasks[i]);
+
+	printf("Memory: %d tasks in %d groups, %lu KiB locked in all, "
+	       "%lu KiB per task on average\n", tester.num_tasks,
+	       tester.num_groups, total / 1024, total / 1024 / tester.num_tasks);
+	for (i = 0; i < tester.num_tasks; i++)
+		printf("\tTask %d: %lu KiB\n", tester.num_tasks - 1 - i,
+		       task_memory(tester.tasks[i]) / 1024);
+}
+
+/*
+ * Print the median, tail and worst of a distribution of times.
+ */
+static void print_percentiles(char *name, struct histogram *h)
+{
+	printf("%s: p50 %lld, p99 %lld, p99.9 %lld, max %lld usec",
+	       name, hist_percentile(h, 50), hist_percentile(h, 99),
+	       hist_percentile(h, 99.9), h->max);
+}
+
+/*
+ * Print the distributions of response time and lateness of the jobs which
+ * completed during the last run, for the whole system and (in verbose output)
+ * for each task.
+ */
+static void print_response_times()
+{
+	int i;
+
+	if (!tester.sys_response.count)
+		return;
+
+	print_percentiles("Response", &tester.sys_response);
+	printf("\n");
+	print_percentiles("Lateness", &tester.sys_lateness);
+	printf("\n");
+	if (tester.options->output_format != OUTPUT_VERBOSE)
+		return;
+
+	for (i = 0; i < tester.num_tasks; i++) {
+		struct task *t = tester.tasks[i];
+
+		if (!t->response.count)
+			continue;
+		printf("\tTask %d: ", tester.num_tasks - 1 - i);
+		print_percentiles("response", &t->response);
+		printf("; ");
+		print_percentiles("lateness", &t->lateness);
+		printf("\n");
+	}
+}
+
+/*
+ * Print how late jobs started after their releases during the last run, for the
+ * jobs whose previous job was done in time to wait for them.
+ */
+static void print_release_jitter()
+{
+	if (!tester.sys_num_jitter)
+		return;
+
+	printf("Release jitter: avg %lu usec, max %lu usec over %u releases\n",
+	       tester.sys_total_jitter / tester.sys_num_jitter,
+	       tester.max_jitter, tester.sys_num_jitter);
+}
+
+/*
+ * Print how long jobs waited to acquire their locks during the last run.
+ */
+static void print_blocking_stats()
+{
+	if (!tester.options->locking || !tester.sys_total_release)
+		return;
+
+	printf("Blocking: avg %lu usec, max %lu usec per job%s\n",
+	       tester.sys_total_blocking / tester.sys_total_release,
+	       tester.max_blocking,
+	       tester.rw_locking ? " (reader/writer locks)" : "");
+}
+
+/*
+ * Print how long aborted tasks took to stop during the last run, for the
+ * backends which record when they abort a task.
+ */
+static void print_abort_latency()
+{
+	if (!tester.sys_num_abort_latency)
+		return;
+
+	printf("Abort latency: avg %lu usec, max %lu usec over %u aborts (%s)\n",
+	       tester.sys_total_abort_latency / tester.sys_num_abort_latency,
+	       tester.max_abort_latency, tester.sys_num_abort_latency,
+	       tester.options->abort_notify ==
+	       CHRONOS_ABORT_SIGNAL ? "signal" : "poll");
+}
+
+/*
+ * Print how many of the jobs planned for the last run it took, if it was ended
+ * early because its statistics had converged.
+ */
+static void print_convergence()
+{
+	int i, planned = 0;
+
+	if (!*tester.converged)
+		return;
+
+	for (i = 0; i < tester.num_tasks; i++)
+		planned += tester.tasks[i]->max_releases;
+	printf("Converged: to within +/- %.1f%% after %d of %d jobs\n",
+	       tester.options->confidence, tester.sys_total_release, planned);
+}
+
+/*
+ * Print how late the tasks woke up for the start of the last run.
+ */
+static void print_start_skew()
+{
+	int i;
+
+	printf("Start skew: avg %ld usec, max %ld usec\n",
+	       tester.sys_total_skew / tester.num_tasks, tester.max_skew);
+	if (tester.options->output_format != OUTPUT_VERBOSE)
+		return;
+	for (i = 0; i < tester.num_tasks; i++)
+		printf("\tTask %d: %ld usec\n", tester.num_tasks - 1 - i,
+		       tester.tasks[i]->start_skew);
+}
+
+/*
+ * Print what the scheduler counted over the last run: on all CPUs, on each CPU
+ * the taskset runs on, in the ChronOS counters and for the task threads.
+ */
+static void print_schedstat()
+{
+	unsigned long long delay = 0, max_delay = 0, voluntary = 0,
+	    involuntary = 0;
+	unsigned long mask = 0;
+	int i, num_valid = 0, host;
+
+	//the host's figures say nothing about a run in virtual time
+	host = schedstat_valid &&
+	    tester.options->backend != CHRONOS_BACKEND_SIM;
+
+	if (host && schedstat_run.context_switches >= 0)
+		printf("Scheduler: %lld context switches on all CPUs\n",
+		       schedstat_run.context_switches);
+	else
+		printf("Scheduler:\n");
+
+	for (i = 0; i < tester.num_tasks; i++)
+		mask |= tester.tasks[i]->cpu_mask;
+	if (!schedstat_valid || !schedstat_run.num_cpus)
+		printf("\tper-CPU statistics unavailable (no /proc/schedstat)\n");
+	for (i = 0; host && i < schedstat_run.num_cpus; i++) {
+		struct chronos_cpu_schedstat *c = &schedstat_run.cpus[i];
+
+		if (!(mask >> i & 1))
+			continue;
+		printf("\tCPU %d: %llu schedule() calls (%llu idle), "
+		       "%llu wakeups, run delay %llu usec\n", i, c->schedules,
+		       c->idle, c->wakeups, c->delay_ns / THOUSAND);
+	}
+	for (i = 0; host && i < schedstat_run.num_counters; i++)
+		printf("\t%s: %lld\n", schedstat_run.counters[i].name,
+		       schedstat_run.counters[i].value);
+
+	for (i = 0; i < tester.num_tasks; i++) {
+		struct chronos_thread_schedstat *s = &tester.tasks[i]->sched;
+
+		if (!tester.tasks[i]->sched_valid)
+			continue;
+		num_valid++;
+		delay += s->delay_ns;
+		if (s->delay_ns > max_delay)
+			max_delay = s->delay_ns;
+		voluntary += s->voluntary_switches;
+		involuntary += s->involuntary_switches;
+	}
+	if (!num_valid)
+		return;
+	printf("Task threads: run delay avg %llu usec, max %llu usec, "
+	       "%llu voluntary and %llu involuntary context switches\n",
+	       delay / num_valid / THOUSAND, max_delay / THOUSAND, voluntary,
+	       involuntary);
+	if (tester.options->output_format != OUTPUT_VERBOSE)
+		return;
+	for (i = 0; i < tester.num_tasks; i++) {
+		struct chronos_thread_schedstat *s = &tester.tasks[i]->sched;
+
+		if (tester.tasks[i]->sched_valid)
+			printf("\tTask %d: run delay %llu usec, %llu voluntary "
+			       "+ %llu involuntary switches\n",
+			       tester.num_tasks - 1 - i, s->delay_ns / THOUSAND,
+			       s->voluntary_switches, s->involuntary_switches);
+	}
+}
+
+/*
+ * Print what the performance counters counted per job in the last run, and in
+ * verbose mode the average for each task.
+ */
+static void print_perf_counters()
+{
+	struct perf_stats *s = &tester.sys_perf;
+	int i, k;
+
+	if (!tester.options->perf_counters)
+		return;
+	printf("Performance counters per job, over %lu jobs:\n", s->jobs);
+	for (k = 0; k < PERF_COUNTERS; k++) {
+		if (!(s->available & 1 << k))
+			printf("\t%s: unavailable\n", perf_counter_names[k]);
+		else if (s->jobs)
+			printf("\t%s: avg %llu, max %llu\n",
+			       perf_counter_names[k], s->total[k] / s->jobs,
+			       s->max[k]);
+	}
+	if (tester.options->output_format != OUTPUT_VERBOSE)
+		return;
+	for (i = 0; i < tester.num_tasks; i++) {
+		struct perf_stats *ts = &tester.tasks[i]->perf;
+
+		printf("\tTask %d:", tester.num_tasks - 1 - i);
+		for (k = 0; k < PERF_COUNTERS; k++)
+			if ((ts->available & 1 << k) && ts->jobs)
+				printf(" %s %llu,", perf_counter_names[k],
+				       ts->total[k] / ts->jobs);
+		printf(" over %lu jobs\n", ts->jobs);
+	}
+}
+
+/*
+ * Print how much of the last run made it into the trace file, if there is one.
+ */
+static void print_trace()
+{
+	if (!tester.options->trace_filename)
+		return;
+	printf("Trace: %lu events written, %lu dropped\n",
+	       tester.trace_written, tester.trace_dropped);
+}
+
 /*
  * Print statistics from the last run of the tester.
  */
 static void print_results()
 {
 	if (tester.options->output_format == OUTPUT_VERBOSE) {
+		long long end = tester.global_start_time->tv_nsec +
+		    (long long)(tester.options->warmup + tester.options->run_time) *
+		    BILLION / tester.options->compression;
+
 		printf("set start_time: %ld sec %ld nsec\n",
 		       tester.global_start_time->tv_sec,
 		       tester.global_start_time->tv_nsec);
-		printf("set end_time: %ld sec %ld nsec\n",
-		       tester.global_start_time->tv_sec +
-		       tester.options->run_time,
-		       tester.global_start_time->tv_nsec);
+		printf("set end_time: %lld sec %lld nsec\n",
+		       tester.global_start_time->tv_sec + end / BILLION,
+		       end % BILLION);
 		printf("total tasks: %d,", tester.sys_total_release);
 		printf("total deadlines met: %d,", tester.sys_met_release);
 		printf("total possible utility: %d,", tester.sys_total_util);
 		printf("total utility accrued: %d,", tester.sys_met_util);
 		printf("total tasks aborted: %d\n", tester.sys_abort_count);
+		print_response_times();
+		print_release_jitter();
+		print_start_skew();
+		print_convergence();
+		print_blocking_stats();
+		print_abort_latency();
+		print_perf_counters();
+		print_schedstat();
+		print_dispatch_stats();
+		print_trace();
 	} else if (tester.options->output_format == OUTPUT_EXCEL) {
 		char *sched_name = get_sched_name(tester.options->scheduler);
 		if (sched_name)
@@ -317,9 +835,78 @@ static void print_results()
 		       tester.sys_total_release, tester.sys_met_util,
 		       tester.sys_total_util, tester.sys_abort_count,
 		       tester.max_tardiness);
+		print_response_times();
+		print_release_jitter();
+		print_start_skew();
+		print_convergence();
+		print_blocking_stats();
+		print_abort_latency();
+		print_perf_counters();
+		print_schedstat();
+		print_dispatch_stats();
+		print_trace();
+	}
+}
+
+/*
+ * Fork every thread group, which in turn starts the rest of its tasks.
+ */
+static void start_groups()
+{
+	int i;
+
+	for (i = 0; i < tester.num_tasks; i++) {
+		if (group_leader(tester.tasks[i]))
+			if (tgroup_create(&tester.tasks[i]->thread.tg,
+					  start_task_group,
+					  (void *)tester.tasks[i]))
+				fatal_error("Failed to tgroup_create "
+					    "one of the task group leader threads.");
+
 	}
 }
 
+/*
+ * Wait until all the thread groups are done.
+ */
+static void join_groups()
+{
+	int i;
+
+	for (i = 0; i < tester.num_tasks; i++) {
+		if (group_leader(tester.tasks[i])) {
+			int ret, status = 0;
+			ret = tgroup_join(&tester.tasks[i]->thread.tg, &status);
+			if (ret)
+				fatal_error("Failed to tgroup_join "
+					    "one of the task group leader processes.");
+			if (status)
+				fatal_error("tgroup_join joined task group "
+					    "leader process with non-zero status.");
+		}
+	}
+}
+
+/*
+ * Once every task has arrived at the barrier, set the start time far enough in
+ * the future for all of them to be asleep waiting for it, and let them go.
+ */
+static void publish_start_time()
+{
+	struct timespec *start = tester.global_start_time;
+	long delay_ns = (START_DELAY_US + START_DELAY_PER_TASK_US *
+			 tester.num_tasks) * THOUSAND;
+
+	pthread_barrier_wait(tester.barrier);
+
+	chronos_clock_gettime(chronos_deadline_clock(), start);
+	start->tv_nsec += delay_ns;
+	start->tv_sec += start->tv_nsec / BILLION;
+	start->tv_nsec %= BILLION;
+
+	pthread_barrier_wait(tester.barrier);
+}
+
 /*
  * Setup for and run one complete run of a taskset in the test application. This
  * includes initializing the real-time priorities, spawning all threads, joining
@@ -333,33 +920,32 @@ static void run()
 	pthread_barrierattr_t barrierattr;
 
 	clear_counters();	//clear performance counters
+	chronos_reset_dispatch_stats();
+	if (tester.options->trace_filename)
+		trace_begin_run(&tester);
 
+	pthread_barrierattr_init(&barrierattr);
 	pthread_barrierattr_setpshared(&barrierattr, PTHREAD_PROCESS_SHARED);	//allow access to this barrier from any process with access to the memory holding it
-	pthread_barrier_init(tester.barrier, &barrierattr, tester.num_tasks);	//initialize barrier
+	pthread_barrier_init(tester.barrier, &barrierattr, tester.num_groups + 1);	//initialize barrier for the group leaders and ourselves
+	pthread_barrierattr_destroy(&barrierattr);
 
-	//set outselves as a real-time task
+	//set outselves as a real-time task (in a simulation nothing runs in real time)
 	sched_getparam(0, &old_param);
-	param.sched_priority = MAIN_PRIO;
-	if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
-		fatal_error("sched_setscheduler() failed.");
+	if (tester.options->backend != CHRONOS_BACKEND_SIM) {
+		param.sched_priority = MAIN_PRIO;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+			fatal_error("sched_setscheduler() failed.");
 
-	//set task affinity of this main thread to the first processor
-	MASK_ZERO(main_mask);
-	MASK_SET(main_mask, 0);
-	if (sched_setaffinity(0, sizeof(main_mask),
-			      (cpu_set_t *) & main_mask) < 0)
-		fatal_error("sched_setaffinity() failed.");
-
-	//set up the correct scheduler on all the domains we need
-	for (i = 0; i < tester.num_processors &&
-	     tester.domain_masks[i] != 0; i++) {
-		if (set_scheduler(get_scheduler(tester.options),
-				  get_priority(tester.options),
-				  tester.domain_masks[i]))
-			fatal_error("Selection of RT scheduler failed! "
-				    "Is the scheduler loaded?");
+		//set task affinity of this main thread to the first processor (of our partition)
+		MASK_ZERO(main_mask);
+		MASK_SET(main_mask, tester.main_cpu);
+		if (sched_setaffinity(0, sizeof(main_mask),
+				      (cpu_set_t *) & main_mask) < 0)
+			fatal_error("sched_setaffinity() failed.");
 	}
 
+	set_schedulers();
+
 	//some debugging/verbose info
 	if (tester.options->output_format == OUTPUT_VERBOSE) {
 		printf("Percent of each task's exec time to use: %f\n",
@@ -381,46 +967,71 @@ static void run()
 			       tester.tasks[i]->locked_usage);
 	}
 
-	//initialize the global_start_time pointer to 0 so it can be reset again by the 'winning' thread
-	tester.global_start_time = 0;
+	*tester.converged = 0;
+	if (tester.options->live)
+		live_begin_run(&tester);
 
-	//start all the thread groups
-	for (i = 0; i < tester.num_tasks; i++) {
-		if (group_leader(tester.tasks[i]))
-			if (tgroup_create(&tester.tasks[i]->thread.tg,
-					  start_task_group,
-					  (void *)tester.tasks[i]))
-				fatal_error("Failed to tgroup_create "
-					    "one of the task group leader threads.");
+	schedstat_valid = !chronos_schedstat_snapshot(&schedstat_start);
 
+	//start all the thread groups and wait until they are done, or just let
+	//them do another run if they stay alive for the whole batch
+	if (tester.control) {
+		pthread_barrier_wait(&tester.control->start);
+		publish_start_time();
+		pthread_barrier_wait(&tester.control->done);
+	} else {
+		start_groups();
+		publish_start_time();
+		join_groups();
 	}
 
-	//wait until all the thread groups are done
-	for (i = 0; i < tester.num_tasks; i++) {
-		if (group_leader(tester.tasks[i])) {
-			int ret, status = 0;
-			ret = tgroup_join(&tester.tasks[i]->thread.tg, &status);
-			if (ret)
-				fatal_error("Failed to tgroup_join "
-					    "one of the task group leader processes.");
-			if (status)
-				fatal_error("tgroup_join joined task group "
-					    "leader process with non-zero status.");
-		}
+	if (schedstat_valid) {
+		struct chronos_schedstat end;
+
+		schedstat_valid = !chronos_schedstat_snapshot(&end);
+		chronos_schedstat_diff(&schedstat_run, &schedstat_start, &end);
 	}
 
 	//return us to a normal scheduler and priority
-	sched_setscheduler(0, SCHED_OTHER, &old_param);
+	if (tester.options->backend != CHRONOS_BACKEND_SIM)
+		sched_setscheduler(0, SCHED_OTHER, &old_param);
+
+	if (tester.options->trace_filename)
+		trace_end_run(&tester, &tester.trace_written,
+			      &tester.trace_dropped);
+	if (tester.options->live)
+		live_end_run(&tester);
 
 	//accumulate statistics from individual tasks
 	for (i = 0; i < tester.num_tasks; i++) {
 		long tardiness;
-		tester.sys_total_release += tester.tasks[i]->max_releases;
+		tester.sys_total_release += tester.tasks[i]->num_counted;
 		tester.sys_met_release += tester.tasks[i]->deadlines_met;
 		tester.sys_total_util +=
-		    tester.tasks[i]->max_releases * tester.tasks[i]->utility;
+		    tester.tasks[i]->num_counted * tester.tasks[i]->utility;
 		tester.sys_met_util += tester.tasks[i]->utility_accrued;
 		tester.sys_abort_count += tester.tasks[i]->num_aborted;
+		tester.sys_total_skew += tester.tasks[i]->start_skew;
+		if (tester.tasks[i]->start_skew > tester.max_skew)
+			tester.max_skew = tester.tasks[i]->start_skew;
+		hist_merge(&tester.sys_response, &tester.tasks[i]->response);
+		hist_merge(&tester.sys_lateness, &tester.tasks[i]->lateness);
+		perf_merge(&tester.sys_perf, &tester.tasks[i]->perf);
+		tester.sys_num_jitter += tester.tasks[i]->num_jitter;
+		tester.sys_total_jitter += tester.tasks[i]->total_jitter;
+		if (tester.tasks[i]->max_jitter > tester.max_jitter)
+			tester.max_jitter = tester.tasks[i]->max_jitter;
+		tester.sys_total_blocking += tester.tasks[i]->total_blocking;
+		if (tester.tasks[i]->max_blocking > tester.max_blocking)
+			tester.max_blocking = tester.tasks[i]->max_blocking;
+		tester.sys_num_abort_latency +=
+		    tester.tasks[i]->num_abort_latency;
+		tester.sys_total_abort_latency +=
+		    tester.tasks[i]->total_abort_latency;
+		if (tester.tasks[i]->max_abort_latency >
+		    tester.max_abort_latency)
+			tester.max_abort_latency =
+			    tester.tasks[i]->max_abort_latency;
 
 		//if this task's tardiness is less than the current maximum, update it
 		//Note: negative tardiness is 'greater' because tardiness is calculated as (deadline - end_time)
@@ -434,6 +1045,372 @@ static void run()
 	pthread_barrier_destroy(tester.barrier);	//destroy barrier
 }
 
+/*
+ * A task group which dies in the middle of a batch leaves the others waiting
+ * at a barrier for it, so take them all down with us. SIGCHLD also comes for
+ * a group which is only stopped (or traced), so make sure one really exited.
+ * The group is left for init to reap: reaping it here, at a real-time
+ * priority, can starve the kernel work that tearing it down waits for.
+ */
+static void group_died(int sig)
+{
+	static const char msg[] =
+	    "Error: A task group exited in the middle of the batch.\n";
+	int i, saved_errno = errno, died = 0;
+	siginfo_t info;
+
+	for (i = 0; i < tester.num_tasks && !died; i++) {
+		if (!group_leader(tester.tasks[i]))
+			continue;
+		info.si_pid = 0;
+		if (!waitid(P_PID, tester.tasks[i]->thread.tg.pid, &info,
+			    WEXITED | WNOHANG | WNOWAIT) && info.si_pid)
+			died = 1;
+	}
+	if (!died) {
+		errno = saved_errno;
+		return;
+	}
+
+	for (i = 0; i < tester.num_tasks; i++)
+		if (group_leader(tester.tasks[i]))
+			kill(tester.tasks[i]->thread.tg.pid, SIGKILL);
+	if (write(STDOUT_FILENO, msg, sizeof(msg) - 1) < 0)
+		_exit(1);
+	_exit(1);
+}
+
+/*
+ * Start task groups which stay alive for all @runs runs of a batch, so that
+ * neither they nor their workloads' data need to be set up again for every
+ * run. A single run doesn't need them. @control is shared memory for them,
+ * which only the main process can salloc.
+ */
+static void start_workers(int runs, struct run_control *control)
+{
+	pthread_barrierattr_t barrierattr;
+	struct sigaction sa;
+
+	if (runs < 2)
+		return;
+
+	tester.control = control;
+	pthread_barrierattr_init(&barrierattr);
+	pthread_barrierattr_setpshared(&barrierattr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(&tester.control->start, &barrierattr,
+			     tester.num_groups + 1);
+	pthread_barrier_init(&tester.control->done, &barrierattr,
+			     tester.num_groups + 1);
+	pthread_barrierattr_destroy(&barrierattr);
+	tester.control->quit = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = group_died;
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGCHLD, &sa, NULL))
+		fatal_error("Failed to install the SIGCHLD handler.");
+
+	start_groups();
+}
+
+/*
+ * Let the task groups started by start_workers exit, once the batch is over.
+ */
+static void stop_workers()
+{
+	if (!tester.control)
+		return;
+
+	signal(SIGCHLD, SIG_DFL);
+	tester.control->quit = 1;
+	pthread_barrier_wait(&tester.control->start);
+	join_groups();
+
+	pthread_barrier_destroy(&tester.control->start);
+	pthread_barrier_destroy(&tester.control->done);
+	tester.control = 0;
+}
+
+/*
+ * Let the system settle between two runs of a batch, unless the task groups
+ * stay alive between them.
+ */
+static void between_runs()
+{
+	if (!tester.control)
+		sleep(1);
+}
+
+/*
+ * Get the number of CPUs, counting from CPU 0, which the taskset spans.
+ */
+static int partition_width()
+{
+	int i, width = 0;
+	unsigned long mask = 0;
+
+	for (i = 0; i < tester.num_tasks; i++)
+		mask |= tester.tasks[i]->cpu_mask;
+	while (mask) {
+		mask >>= 1;
+		width++;
+	}
+	return width;
+}
+
+/*
+ * Move the taskset which was just read in over by @shift CPUs, so that it runs
+ * on a partition of its own.
+ */
+static void shift_partition(int shift)
+{
+	int i;
+
+	for (i = 0; i < tester.num_tasks; i++)
+		tester.tasks[i]->cpu_mask <<= shift;
+	for (i = 0; i < tester.num_processors &&
+	     tester.domain_masks[i] != 0; i++)
+		tester.domain_masks[i] <<= shift;
+	tester.main_cpu = shift;
+}
+
+/*
+ * Everything a partition's worker process needs to run its share of a batch.
+ * Usage number n of the batch is run by partition n % num_partitions, and its
+ * output ends at offset point_end[n] of that partition's output file.
+ */
+struct partition {
+	struct test tester;
+	struct run_control *control;
+	tgroup_t worker;
+	FILE *output;
+};
+
+static struct partition *partitions;
+static int num_partitions;
+static long *point_end;
+
+/*
+ * Run every num_partitions'th usage of the batch, starting with partition @arg,
+ * in a worker process. Its output goes to the partition's file, to be merged
+ * once all of them are done.
+ */
+static int run_partition(void *arg)
+{
+	struct partition *p = (struct partition *)arg;
+	struct test_app_opts *options = p->tester.options;
+	int n = p - partitions;
+
+	tester = p->tester;
+	if (dup2(fileno(p->output), STDOUT_FILENO) < 0)
+		fatal_error("Failed to redirect the output of a partition.");
+
+	options->cpu_usage += n * options->interval;
+	start_workers((options->end_usage - options->cpu_usage) /
+		      (num_partitions * options->interval) + 1, p->control);
+	for (; options->cpu_usage <= options->end_usage;
+	     options->cpu_usage += num_partitions * options->interval) {
+		run();
+		fflush(stdout);
+		point_end[n] = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+		n += num_partitions;
+		if (options->cpu_usage + num_partitions * options->interval <=
+		    options->end_usage)
+			between_runs();
+	}
+	stop_workers();
+	return 0;
+}
+
+/*
+ * Copy the output of every usage of the batch to stdout, in order.
+ */
+static void merge_partition_output(int num_points)
+{
+	char buf[4096];
+	long start, len;
+	ssize_t ret;
+	int n;
+
+	for (n = 0; n < num_points; n++) {
+		int fd = fileno(partitions[n % num_partitions].output);
+
+		start = n < num_partitions ? 0 : point_end[n - num_partitions];
+		for (len = point_end[n] - start; len > 0; len -= ret) {
+			ret = pread(fd, buf, len < sizeof(buf) ? len : sizeof(buf),
+				    start);
+			if (ret <= 0)
+				fatal_error("Failed to read the output of a partition.");
+			fwrite(buf, 1, ret, stdout);
+			start += ret;
+		}
+	}
+	fflush(stdout);
+}
+
+/*
+ * Run the usages of a batch concurrently, each partition on its own CPUs with
+ * its own copy of the taskset. Returns 0 if there aren't enough CPUs for more
+ * than one partition, so the batch should be run one usage at a time instead.
+ */
+static int run_partitioned(struct test_app_opts *options)
+{
+	int i, width, num_points;
+
+	num_points = (options->end_usage - options->cpu_usage) /
+	    options->interval + 1;
+	width = partition_width();
+	num_partitions = options->partitions;
+	if (num_partitions > tester.num_processors / width)
+		num_partitions = tester.num_processors / width;
+	if (num_partitions > num_points)
+		num_partitions = num_points;
+	if (num_partitions < 2) {
+		warning("Not enough CPUs to partition the batch, "
+			"running one usage at a time.");
+		options->partitions = 1;
+		return 0;
+	}
+	options->partitions = num_partitions;
+
+	partitions = (struct partition *)malloc(sizeof(struct partition) *
+						num_partitions);
+	point_end = (long *)salloc(sizeof(long) * num_points);
+	if (!partitions || !point_end)
+		fatal_error("Failed to allocate memory.");
+
+	//every partition gets its own copy of the taskset, read in from here so
+	//they all come from the one shared memory region
+	for (i = 0; i < num_partitions; i++) {
+		if (i) {
+			tester.task_list = 0;
+			tester.tasks = 0;
+			tester.num_tasks = 0;
+			tester.num_groups = 0;
+			tester.locks = 0;
+			tester.rwlocks = 0;
+			tester.num_locks = -1;
+			tester.rw_locking = 0;
+			tester.barrier = salloc(sizeof(pthread_barrier_t));
+			if (!tester.barrier)
+				fatal_error("pthread_barrier_t memory allocation failed.");
+			init_tasks(options->taskset_filename);
+			shift_partition(i * width);
+		}
+		partitions[i].tester = tester;
+		partitions[i].control = salloc(sizeof(struct run_control));
+		partitions[i].output = tmpfile();
+		if (!partitions[i].control || !partitions[i].output)
+			fatal_error("Failed to create the output file of a partition.");
+	}
+
+	for (i = 0; i < num_partitions; i++) {
+		if (tgroup_create(&partitions[i].worker,
+				  run_partition, &partitions[i]))
+			fatal_error("Failed to start the process of a partition.");
+	}
+
+	for (i = 0; i < num_partitions; i++) {
+		int status = 0;
+		if (tgroup_join(&partitions[i].worker,
+				&status) || status)
+			fatal_error("The process of a partition failed.");
+	}
+
+	merge_partition_output(num_points);
+
+	//leave the first partition's taskset for run_test() to clean up
+	for (i = 1; i < num_partitions; i++) {
+		tester = partitions[i].tester;
+		cleanup_test_locks();
+		cleanup_tasks();
+		sfree(tester.barrier);
+	}
+	for (i = 0; i < num_partitions; i++) {
+		sfree(partitions[i].control);
+		fclose(partitions[i].output);
+	}
+	tester = partitions[0].tester;
+	sfree(point_end);
+	free(partitions);
+	return 1;
+}
+
+/*
+ * Run the taskset at @usage, returning the percentage of deadlines met.
+ */
+static double run_usage(struct test_app_opts *options, int usage)
+{
+	options->cpu_usage = usage;
+	run();
+	if (!tester.sys_total_release)
+		return 100;
+	return 100.0 * tester.sys_met_release / tester.sys_total_release;
+}
+
+/*
+ * Bisect between the start and end usages of the batch for the usage at which
+ * the percentage of deadlines met falls below the breakdown threshold, until
+ * the bracket is no wider than the interval. This assumes that meeting
+ * deadlines only gets harder as the usage goes up.
+ */
+static void search_breakdown(struct test_app_opts *options)
+{
+	int lo, hi, mid, runs = 2;
+	double lo_met, hi_met, met;
+
+	lo = options->cpu_usage;
+	hi = options->end_usage;
+	start_workers(hi > lo ? 2 : 1, batch_control);
+	lo_met = run_usage(options, lo);
+	if (lo_met >= options->breakdown && hi > lo) {
+		between_runs();
+		hi_met = run_usage(options, hi);
+	} else {
+		hi_met = lo_met;
+		runs = 1;
+	}
+
+	if (lo_met < options->breakdown)
+		hi = lo;
+	else if (hi_met >= options->breakdown)
+		lo = hi;
+
+	//the end usage needn't be a whole number of intervals from the start
+	while (hi - lo > options->interval) {
+		mid = (hi - lo) / options->interval / 2;
+		mid = lo + (mid ? mid : 1) * options->interval;
+		between_runs();
+		met = run_usage(options, mid);
+		runs++;
+		if (met >= options->breakdown) {
+			lo = mid;
+			lo_met = met;
+		} else {
+			hi = mid;
+			hi_met = met;
+		}
+	}
+	stop_workers();
+
+	if (options->output_format != OUTPUT_LOG &&
+	    options->output_format != OUTPUT_VERBOSE)
+		return;
+
+	if (lo == hi && lo_met < options->breakdown)
+		printf("Breakdown: below %d%% cpu usage (%.1f%% met there)",
+		       lo, lo_met);
+	else if (lo == hi)
+		printf("Breakdown: above %d%% cpu usage (%.1f%% met there)",
+		       hi, hi_met);
+	else
+		printf("Breakdown: between %d%% cpu usage (%.1f%% met) and "
+		       "%d%% (%.1f%% met)", lo, lo_met, hi, hi_met);
+	printf(" for %d%% deadlines met, after %d runs\n",
+	       options->breakdown, runs);
+}
+
 /*
  * Given the options passed in on the command line, initialize the application
  * and call each of the individual runs (will only be one if batch mode is not
@@ -447,33 +1424,65 @@ void run_test(struct test_app_opts *options)
 	tester.barrier = salloc(sizeof(pthread_barrier_t));
 	if (!tester.barrier)
 		fatal_error("pthread_barrier_t memory allocation failed.");
+	batch_control = salloc(sizeof(struct run_control));
+	if (!batch_control)
+		fatal_error("Failed to allocate memory.");
 
 	tester.workload = get_workload_struct(tester.options->workload);
-	workload_init_global(&tester);	// initialize any global state the current workload has (allocating global memory, etc.)
+	workload_init_global(&tester);
+	workload_init_aborts(&tester);	// initialize any global state the current workload has (allocating global memory, etc.)
 
 	//initialize tasks based on the taskset file
 	init_tasks(options->taskset_filename);
 
-	//if requested, find the hyper-period and return
+	//initialize the abort device
+	if (init_aborts(&tester.abort_data))
+		fatal_error("Failed to initialize abort device.");
+
+	if (options->output_format == OUTPUT_VERBOSE)
+		print_memory();
+
+	//if requested, find the hyper-period, analyse the taskset and return
 	if (tester.options->no_run) {
 		printf("No run (-z) flag enabled\n");
-		printf("Hyper-period is: %ld seconds\n",
+		printf("Hyper-period is: %lu seconds\n",
 		       taskset_lcm(&tester) / MILLION);
+		analyze_taskset(&tester);
 		return;
 	}
 
 	if (options->enable_hua)
 		calc_lock_time();	//calculate how long locking takes (needed to calculate HUA abort handler timing information)
 
-	//actually run the tests
-	for (; options->cpu_usage <= options->end_usage;
-	     options->cpu_usage += options->interval) {
-		run();
-		if (options->cpu_usage < options->end_usage)
-			sleep(1);
+	check_compression();	//make sure time can be compressed as far as asked
+
+	//give the tasks their trace rings before the task groups are forked
+	if (options->trace_filename)
+		trace_open(&tester, options->trace_filename);
+	if (options->live)
+		live_open(&tester);
+
+	//actually run the tests, several usages at once if they can be partitioned
+	if (options->breakdown)
+		search_breakdown(options);
+	else if (options->partitions <= 1 || !run_partitioned(options)) {
+		start_workers((options->end_usage - options->cpu_usage) /
+			      options->interval + 1, batch_control);
+		for (; options->cpu_usage <= options->end_usage;
+		     options->cpu_usage += options->interval) {
+			run();
+			if (options->cpu_usage < options->end_usage)
+				between_runs();
+		}
+		stop_workers();
 	}
 
+	if (options->trace_filename)
+		trace_close(&tester);
+	if (options->live)
+		live_close(&tester);
 	cleanup_test_locks();
 	cleanup_tasks();
 	sfree(tester.barrier);
+	sfree(batch_control);
 }
@@ -43,7 +43,7 @@
  */
 static inline unsigned long gcd(unsigned long m, unsigned long n)
 {
-	int t, r;
+	unsigned long t, r;
 	if (m < n) {
 		t = m;
 		m = n;
@@ -61,13 +61,13 @@ static inline unsigned long gcd(unsigned long m, unsigned long n)
  * Calculate the hyper period for the task set. This is also known as the lowest
  * common multiple of all the tasks' periods.
  */
-static inline long taskset_lcm(struct test *tester)
+static inline unsigned long taskset_lcm(struct test *tester)
 {
 	int i;
-	long lcm = tester->tasks[0]->period;
+	unsigned long lcm = tester->tasks[0]->period;
 
 	for (i = 1; i < tester->num_tasks; i++) {
-		int GCD = gcd(lcm, tester->tasks[i]->period);
+		unsigned long GCD = gcd(lcm, tester->tasks[i]->period);
 		lcm = lcm / GCD;
 		lcm = lcm * tester->tasks[i]->period;
 	}
@@ -27,13 +27,17 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
 
 #include <chronos/chronos.h>
 #include <chronos/chronos_aborts.h>
+#include <chronos/chronos_schedstat.h>
 
 #include "utils.h"
 #include "salloc.h"
+#include "histogram.h"
+#include "perf.h"
 
 #ifndef TESTER_TYPES_H
 #define TESTER_TYPES_H
@@ -55,6 +59,10 @@
 //2 intentionally skipped - see next line
 #define NESTED_LOCKING 3	//(can be logically or-ed w/ LOCKING and will still be true, since NESTED_LOCKING is a superset of LOCKING)
 
+//access modes for a task's locks, given as a suffix to each lock in the taskset
+#define LOCK_MODE_READ  'r'
+#define LOCK_MODE_WRITE 'w'
+
 /*
  * Holds data necessary for each thread group in our internal mini threading library
  */
@@ -80,6 +88,8 @@ struct test_app_opts {
 	int enable_hua;		//enable HUA abort handlers
 	int deadlock_prevention;	//enable deadlock-prevention
 	int no_run;		//don't run the test, just find the hyper-period
+	int backend;		//libchronos backend, one of CHRONOS_BACKEND_*
+	int abort_notify;	//how aborts are delivered, one of CHRONOS_ABORT_*
 
 	int locking;		//enable locking. One of NO_LOCKING, LOCKING, NESTED_LOCKING.
 	int cs_length;		//lock critical section length (as a percentage of the total execution time of tasks)
@@ -88,8 +98,20 @@ struct test_app_opts {
 	int batch_mode;		//off by default (0)
 	int end_usage;		//the usage to stop at for batch mode (set same as cpu_usage for non-batch mode)
 	int interval;		//how much to increment for each iteration/interval in batch mode
+	int partitions;		//how many usages of the batch to run at once, each on its own CPUs
+	int breakdown;		//search for the usage where the percent of deadlines met falls below this, instead of sweeping (0 to sweep)
+	int warmup;		//seconds of jobs at the start of each run to leave out of the statistics
+	double confidence;	//end a run early once the 95% confidence intervals of DSR and AUR are narrower than +/- this percent (0 to never)
+	int stack_kb;		//stack size of each task thread in KiB (0 for the system default)
+	int compression;	//divide every period, execution, run and warm-up time by this
+	char *trace_filename;	//file to trace every job to (null for none)
+	int perf_counters;	//count the hardware and software events of every job
+	int live;		//publish live statistics for chronos_top
 };
 
+struct trace_ring;
+struct live_task;
+
 /*
  * The struct which holds all the data needed for each task being executed.
  */
@@ -112,10 +134,17 @@ struct task {
 	int task_id, thread_id;
 	int num_my_locks;
 	chronos_mutex_t **my_locks;	//array where the first num_my_locks elements are the indices of locks we must lock
+	char *my_lock_modes;	//LOCK_MODE_READ or LOCK_MODE_WRITE for each of my_locks, used when the taskset gives access modes
+
+	struct trace_ring *trace;	//where this task's jobs are traced to (null if they aren't)
+	struct live_task *live;	//where this task's live statistics are published (null if they aren't)
 
 	unsigned long cpu_mask;
 	unsigned int thread_group;
 	struct task *group_leader;
+	struct task *next_in_group;	//the next task of our group (the leader heads the list of the others)
+	int group_size;		//number of tasks in this group (only valid if this task is a group leader)
+	pthread_barrier_t group_barrier;	//where the tasks of this group gather before the start barrier (only valid if this task is a group leader)
 
 	//real-time properties set from taskset file
 	unsigned long period;
@@ -129,16 +158,34 @@ struct task {
 	//variables controlling execution - initialized from a combination of the taskset file parameters and the command-line arguments
 	unsigned long locked_usage;	//microseconds to burn while locked
 	unsigned long unlocked_usage;	//microseconds to burn while unlocked
-	int max_releases;	//the number of releases this task will have
+	int warmup_releases;	//the number of releases before those counted in the statistics
+	int max_releases;	//the number of releases this task will have counted
 	int extra_release;	//true if this task needs an extra release, where the runtime statistics are not calculated
 
 	//actual execution statistics
 	struct timespec local_start_time;	//the time this thread observes it started its thread
+	long start_skew;	//microseconds after the global start time this thread woke up
 	unsigned int num_releases;
+	unsigned int num_counted;	//releases counted in the statistics so far
 	unsigned int num_aborted;
 	unsigned int deadlines_met;
 	unsigned int utility_accrued;
 	long max_tardiness;
+	struct histogram response;	//microseconds from release to completion of the jobs which completed
+	struct histogram lateness;	//microseconds from deadline to completion of the same jobs (negative if early)
+	int waited;		//true if the last job finished before this one's release, so this one waited for it
+	unsigned int num_jitter;	//counted releases the task waited for
+	unsigned long total_jitter;	//microseconds those jobs started after their release instants
+	unsigned long max_jitter;
+	unsigned long total_blocking;	//microseconds spent waiting to acquire locks
+	unsigned long max_blocking;	//the longest any one job waited for its locks
+	unsigned int num_abort_latency;	//aborted jobs whose abort time the backend recorded
+	unsigned long total_abort_latency;	//microseconds from those jobs' aborts until they stopped
+	unsigned long max_abort_latency;
+	struct perf_group perf_group;	//the counters of this task's thread, open while it runs
+	struct perf_stats perf;	//what they counted over the counted jobs
+	struct chronos_thread_schedstat sched;	//what the scheduler counted for this task's thread over the run
+	int sched_valid;	//false if it couldn't be read
 };
 
 /*
@@ -156,9 +203,14 @@ static inline struct task *new_task(struct test *tester)
 	t->task_id = 0;
 	t->thread_id = 0;
 	t->my_locks = 0;
+	t->my_lock_modes = 0;
+	t->trace = 0;
+	t->live = 0;
 	MASK_ZERO(t->cpu_mask);
 	t->thread_group = 0;
 	t->group_leader = 0;
+	t->next_in_group = 0;
+	t->group_size = 0;
 	t->period = 0;
 	t->exec_time = 0;
 	t->utility = 0;
@@ -166,10 +218,25 @@ static inline struct task *new_task(struct test *tester)
 	t->task_wss = -1;
 	t->group_wss = -1;
 	t->num_releases = 0;
+	t->num_counted = 0;
 	t->num_aborted = 0;
 	t->deadlines_met = 0;
 	t->utility_accrued = 0;
 	t->max_tardiness = 0;
+	hist_clear(&t->response);
+	hist_clear(&t->lateness);
+	t->waited = 0;
+	t->num_jitter = 0;
+	t->total_jitter = 0;
+	t->max_jitter = 0;
+	t->total_blocking = 0;
+	t->max_blocking = 0;
+	t->num_abort_latency = 0;
+	t->total_abort_latency = 0;
+	t->max_abort_latency = 0;
+	perf_clear(&t->perf);
+	memset(&t->sched, 0, sizeof(t->sched));
+	t->sched_valid = 0;
 	return t;
 }
 
@@ -179,12 +246,40 @@ static inline struct task *new_task(struct test *tester)
 static inline void clear_task_stats(struct task *t)
 {
 	t->num_releases = 0;
+	t->num_counted = 0;
 	t->num_aborted = 0;
 	t->deadlines_met = 0;
 	t->utility_accrued = 0;
 	t->max_tardiness = 0;
+	hist_clear(&t->response);
+	hist_clear(&t->lateness);
+	t->waited = 0;
+	t->num_jitter = 0;
+	t->total_jitter = 0;
+	t->max_jitter = 0;
+	t->total_blocking = 0;
+	t->max_blocking = 0;
+	t->num_abort_latency = 0;
+	t->total_abort_latency = 0;
+	t->max_abort_latency = 0;
+	perf_clear(&t->perf);
+	memset(&t->sched, 0, sizeof(t->sched));
+	t->sched_valid = 0;
 }
 
+/*
+ * Shared by the main process and the task groups when the task groups stay
+ * alive for a whole batch. The main process sets the tasks up for each run and
+ * then lets them go through the start barrier; they wait at the done barrier
+ * once the run is over. Only the group leaders and the main process wait at
+ * them, the other tasks at their group's barrier.
+ */
+struct run_control {
+	pthread_barrier_t start;
+	pthread_barrier_t done;
+	int quit;		//set before the last start, once the batch is over
+};
+
 /*
  * Struct to hold the global data for the test application.
  */
@@ -196,9 +291,14 @@ struct test {
 	struct task *task_list;	//initial list (linked by next pointer)
 	struct task **tasks;	//later, we build an array for constant-time access
 	unsigned int num_tasks;	//number of tasks in tasks array
+	unsigned int num_groups;	//number of thread groups among them
+	struct task **group_table;	//hash table of the group leaders by thread group, while the taskset is read
+	unsigned int group_table_size;
 
 	chronos_mutex_t *locks;	//array of locks
+	chronos_rwlock_t *rwlocks;	//reader/writer locks for the same resources
 	int num_locks;		//number of locks in locks array
+	int rw_locking;		//true if the taskset gives access modes, so tasks use rwlocks
 
 	unsigned long lock_time;	//the amount of time it takes (in microseconds) to pthread_create, lock a lock, unlock it, and pthread_join
 
@@ -206,9 +306,12 @@ struct test {
 
 	unsigned int num_processors;
 	unsigned long *domain_masks;
+	int main_cpu;		//the CPU the main thread runs on, the first one of our partition
 
 	pthread_barrier_t *barrier;
-	struct timespec *global_start_time;
+	struct timespec *global_start_time;	//the time (on chronos_deadline_clock) every task starts at, set in shared memory before each run
+	struct run_control *control;	//non-null while the task groups stay alive between runs
+	int *converged;		//shared flag set by the first task to find the statistics have converged, ending the run
 
 	/* System level performance statistics */
 	int sys_total_release;	// The total number of tasks
@@ -217,6 +320,21 @@ struct test {
 	int sys_met_util;	// The total utility of all tasks that met deadlines
 	int sys_abort_count;	// The number of threads aborted
 	long max_tardiness;	// The highest tardiness of any task
+	struct histogram sys_response;	// Response times of all the tasks' jobs
+	struct histogram sys_lateness;	// Lateness of all the tasks' jobs
+	unsigned int sys_num_jitter;	// The number of releases waited for
+	unsigned long sys_total_jitter;	// Microseconds those jobs started after their releases, summed
+	unsigned long max_jitter;	// The latest any job started after its release
+	unsigned long sys_total_blocking;	// Microseconds all jobs spent waiting for locks
+	unsigned long max_blocking;	// The longest any job waited for its locks
+	unsigned int sys_num_abort_latency;	// The number of aborts timed
+	unsigned long sys_total_abort_latency;	// Microseconds from abort to the task stopping, summed
+	unsigned long max_abort_latency;	// The longest any task took to stop once aborted
+	long sys_total_skew;	// Microseconds the tasks woke up after the start time, summed
+	long max_skew;		// The latest any task woke up
+	struct perf_stats sys_perf;	// What the performance counters counted over all the tasks' jobs
+	unsigned long trace_written;	// Events written to the trace file
+	unsigned long trace_dropped;	// Events lost because a task's trace ring was full
 };
 
 #endif				/*TESTER_TYPES_H */
@@ -31,13 +31,18 @@
  */
 int tgroup_create(tgroup_t * tgroup, int (*fn) (void *), void *arg)
 {
-	pid_t pid = fork();
+	pid_t pid;
 
+	/* don't let the child inherit (and later repeat) buffered output */
+	fflush(stdout);
+
+	pid = fork();
 	if (pid == -1) {
 		return -1;
 	} else if (pid == 0) {
 		/* re-lock all the memory, because these locks were lost on fork() */
-		if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		if (chronos_get_backend() != CHRONOS_BACKEND_SIM
+		    && mlockall(MCL_CURRENT | MCL_FUTURE))
 			fatal_error("Failed to re-lock all memory on fork()\n");
 		exit(fn(arg));
 	} else {
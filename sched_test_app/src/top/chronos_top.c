@@ -0,0 +1,220 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../utils.h"
+#include "../live.h"
+
+#define DEFAULT_INTERVAL	1000	//milliseconds between refreshes
+
+void print_usage()
+{
+	printf("Live monitor for sched_test_app (version ");
+	printf(VERSION);
+	printf(")\n");
+	printf("------------------------------------------------------\n");
+	printf("Usage: chronos_top [flags] [pid]\n");
+	printf("Shows the run of the sched_test_app process pid (started with"
+	       " -m), or of the\nonly one running if pid is left out.\n");
+	printf("Optional flags:\n");
+	printf("  -i interval   "
+	       "Milliseconds between refreshes (default %d).\n",
+	       DEFAULT_INTERVAL);
+	printf("  -n count      "
+	       "Exit after count refreshes (default: when the test exits).\n");
+	printf("\n");
+}
+
+/*
+ * Find the pid of the one sched_test_app which is publishing live statistics.
+ */
+static pid_t find_test()
+{
+	const char *prefix = LIVE_SHM_PREFIX + 1;	//shm_open's leading slash
+	struct dirent *ent;
+	pid_t pid = 0;
+	DIR *dir;
+
+	if (!(dir = opendir("/dev/shm")))
+		fatal_error("Failed to look for live statistics in /dev/shm.");
+
+	while ((ent = readdir(dir))) {
+		if (strncmp(ent->d_name, prefix, strlen(prefix)))
+			continue;
+		if (pid)
+			fatal_error("More than one test is running, "
+				    "give the pid of one.");
+		pid = atoi(ent->d_name + strlen(prefix));
+	}
+	closedir(dir);
+
+	if (!pid)
+		fatal_error("No test is publishing live statistics "
+			    "(was it started with -m?).");
+	return pid;
+}
+
+static struct live_stats *open_live(pid_t pid)
+{
+	struct live_stats *live;
+	char name[32];
+	struct stat st;
+	int fd;
+
+	snprintf(name, sizeof(name), LIVE_SHM_PREFIX "%d", pid);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1)
+		fatal_error("Failed to open the live statistics.");
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(struct live_stats))
+		fatal_error("The live statistics are incomplete.");
+	live = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (live == MAP_FAILED)
+		fatal_error("Failed to map the live statistics.");
+
+	//the test fills in the header before it sets the magic number
+	while (__atomic_load_n(&live->magic, __ATOMIC_ACQUIRE) != LIVE_MAGIC)
+		usleep(THOUSAND);
+	if (st.st_size < (off_t) (sizeof(struct live_stats) +
+				  sizeof(struct live_task) * live->num_tasks))
+		fatal_error("The live statistics are incomplete.");
+	return live;
+}
+
+static double percent(unsigned int part, unsigned int whole)
+{
+	return whole ? 100.0 * part / whole : 0;
+}
+
+static void print_live(pid_t pid, struct live_stats *live)
+{
+	struct live_stats header;
+	struct live_task task;
+	struct timespec now;
+	unsigned long released = 0, counted = 0, met = 0, aborted = 0;
+	long elapsed = 0, max_tardiness = 0;
+	int i;
+
+	live_read(&live->seq, &header, live, offsetof(struct live_stats, tasks));
+
+	if (isatty(STDOUT_FILENO))
+		printf("\033[H\033[J");	//clear the screen
+
+	printf("sched_test_app %d: %s, %d%% usage, run %d", pid,
+	       header.scheduler, header.usage, header.run);
+	if (header.state == LIVE_RUNNING) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		elapsed = (now.tv_sec - header.start.tv_sec) * THOUSAND +
+		    (now.tv_nsec - header.start.tv_nsec) / MILLION;
+		if (elapsed > header.run_ms)
+			elapsed = header.run_ms;
+		printf(", %.1f of %.1f s\n", elapsed / 1000.0,
+		       header.run_ms / 1000.0);
+	} else if (header.state == LIVE_DONE) {
+		printf(", done\n");
+	} else {
+		printf(", between runs\n");
+	}
+
+	printf("\n%5s %12s %9s %9s %9s %9s %8s %9s %14s\n", "Task",
+	       "Period (us)", "Progress", "Released", "Counted", "Met", "DSR",
+	       "Aborted", "Max tard. (us)");
+	for (i = 0; i < header.num_tasks; i++) {
+		live_read(&live->tasks[i].seq, &task, &live->tasks[i],
+			  sizeof(task));
+
+		printf("%5d %12lu %8.1f%% %9u %9u %9u %7.2f%% %9u %14ld\n", i,
+		       task.period, percent(task.releases, task.planned),
+		       task.releases, task.counted, task.met,
+		       percent(task.met, task.counted), task.aborted,
+		       task.max_tardiness);
+
+		released += task.releases;
+		counted += task.counted;
+		met += task.met;
+		aborted += task.aborted;
+		if (task.max_tardiness > max_tardiness)
+			max_tardiness = task.max_tardiness;
+	}
+
+	printf("%5s %12s %9s %9lu %9lu %9lu %7.2f%% %9lu %14ld\n", "All", "",
+	       "", released, counted, met,
+	       counted ? 100.0 * met / counted : 0, aborted, max_tardiness);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	char optstring[] = "i:n:";
+	struct live_stats *live;
+	int interval = DEFAULT_INTERVAL;
+	int count = 0;		//refreshes left, or 0 to keep going
+	pid_t pid;
+	int c;
+
+	while ((c = getopt(argc, argv, optstring)) != -1) {
+		switch (c) {
+		case 'i':
+			interval = atoi(optarg);
+			if (interval <= 0)
+				fatal_error("The interval must be positive.");
+			break;
+		case 'n':
+			count = atoi(optarg);
+			if (count <= 0)
+				fatal_error("The count must be positive.");
+			break;
+		default:
+			print_usage();
+			return 0;
+		}
+	}
+
+	if (optind < argc - 1) {
+		print_usage();
+		return 1;
+	}
+	pid = optind < argc ? atoi(argv[optind]) : find_test();
+	live = open_live(pid);
+
+	while (1) {
+		print_live(pid, live);
+
+		if (__atomic_load_n(&live->state, __ATOMIC_ACQUIRE) == LIVE_DONE)
+			break;
+		if (kill(pid, 0) && errno == ESRCH) {
+			printf("\nThe test has exited.\n");
+			break;
+		}
+		if (count && !--count)
+			break;
+		usleep(interval * THOUSAND);
+	}
+
+	return 0;
+}
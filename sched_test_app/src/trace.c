@@ -0,0 +1,543 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * The trace file starts with TRACE_MAGIC, the format version, the number of
+ * tasks and the period of each (in microseconds, in the order the taskset
+ * lists them). Then come the events, each one a byte for its type followed by
+ * the task, the job, the time, the TSC and the argument. Everything but the
+ * type is a varint (7 bits a byte, least significant first) and the job, time
+ * and TSC are zigzag-encoded differences from the last event of the same task,
+ * so a typical event takes a dozen bytes. A TRACE_RUN event sets the last event
+ * of every task back to zero, so it carries the absolute time. A TRACE_COUNTER
+ * event has its count in place of the TSC, as is.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "utils.h"
+#include "trace.h"
+
+#define TRACE_MAGIC	"CHRTRACE"
+#define TRACE_VERSION	1
+#define TRACE_DRAIN_US	10000	//how often the drain thread empties the rings
+#define TRACE_MAX_HELD	64	//locks one job may hold at once, as far as export_trace is concerned
+#define TRACE_BUF_SIZE	65536
+
+struct trace_last {
+	unsigned long long time;
+	unsigned long long tsc;
+	unsigned int job;
+};
+
+/*
+ * The file is written through a buffer of our own rather than stdio, so that
+ * the task groups, which are forked with a copy of it, don't write it out
+ * again when they exit.
+ */
+static int trace_fd = -1;
+static unsigned char trace_buf[TRACE_BUF_SIZE];
+static int trace_len;
+static int trace_failed;	//true once a write to the file has failed
+static struct trace_last *trace_last;	//the last event written of each task
+static pthread_t drain_thread;
+static int drain_stop;
+static unsigned long trace_written;
+
+static inline unsigned long long read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/*
+ * The next free event of @t's ring, or null if it is full. The event is only
+ * seen by the drain thread once it is committed with commit_event.
+ */
+static struct trace_event *next_event(struct task *t, int type, int arg,
+				      struct timespec *when)
+{
+	struct trace_ring *r = t->trace;
+	struct trace_event *e;
+	struct timespec now;
+
+	if (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >=
+	    TRACE_RING_EVENTS) {
+		r->dropped++;
+		return 0;
+	}
+
+	if (!when) {
+		chronos_clock_gettime(chronos_deadline_clock(), &now);
+		when = &now;
+	}
+
+	e = &r->events[r->head & (TRACE_RING_EVENTS - 1)];
+	e->time = (unsigned long long)when->tv_sec * BILLION + when->tv_nsec;
+	e->job = t->num_releases;
+	e->type = type;
+	e->arg = arg;
+	return e;
+}
+
+static void commit_event(struct task *t)
+{
+	__atomic_store_n(&t->trace->head, t->trace->head + 1,
+			 __ATOMIC_RELEASE);
+}
+
+void trace_event(struct task *t, int type, int arg, struct timespec *when)
+{
+	struct trace_event *e;
+
+	if (!t->trace || !(e = next_event(t, type, arg, when)))
+		return;
+	e->tsc = read_tsc();
+	commit_event(t);
+}
+
+void trace_counters(struct task *t, unsigned int available,
+		    unsigned long long *counts, struct timespec *when)
+{
+	struct trace_event *e;
+	int i;
+
+	if (!t->trace)
+		return;
+	for (i = 0; i < PERF_COUNTERS; i++) {
+		if (!(available & 1 << i) ||
+		    !(e = next_event(t, TRACE_COUNTER, i, when)))
+			continue;
+		e->count = counts[i];
+		commit_event(t);
+	}
+}
+
+static void flush_trace()
+{
+	int done = 0, ret;
+
+	while (done < trace_len) {
+		ret = write(trace_fd, trace_buf + done, trace_len - done);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			trace_failed = 1;
+			break;
+		}
+		done += ret;
+	}
+	trace_len = 0;
+}
+
+static void put_byte(unsigned char c)
+{
+	if (trace_len == TRACE_BUF_SIZE)
+		flush_trace();
+	trace_buf[trace_len++] = c;
+}
+
+static void put_varint(unsigned long long v)
+{
+	while (v >= 0x80) {
+		put_byte((v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	put_byte(v);
+}
+
+static void put_delta(unsigned long long now, unsigned long long last)
+{
+	long long d = now - last;
+
+	put_varint(((unsigned long long)d << 1) ^ (d >> 63));
+}
+
+/*
+ * Append an event of the task at index @task (in taskset order) to the file.
+ */
+static void write_event(struct trace_event *e, int task)
+{
+	struct trace_last *last = &trace_last[task];
+
+	put_byte(e->type);
+	put_varint(task);
+	put_delta(e->job, last->job);
+	put_delta(e->time, last->time);
+	if (e->type == TRACE_COUNTER)
+		put_varint(e->count);
+	else
+		put_delta(e->tsc, last->tsc);
+	put_varint(e->arg);
+
+	last->job = e->job;
+	last->time = e->time;
+	if (e->type != TRACE_COUNTER)
+		last->tsc = e->tsc;
+	trace_written++;
+}
+
+/*
+ * Write out every event waiting in the rings.
+ */
+static void drain_rings(struct test *tester)
+{
+	int i;
+
+	for (i = 0; i < tester->num_tasks; i++) {
+		struct trace_ring *r = tester->tasks[i]->trace;
+		unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = r->tail;
+
+		for (; tail != head; tail++)
+			write_event(&r->events[tail & (TRACE_RING_EVENTS - 1)],
+				    tester->num_tasks - 1 - i);
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+static void *drain_main(void *p)
+{
+	struct test *tester = (struct test *)p;
+
+	while (!__atomic_load_n(&drain_stop, __ATOMIC_ACQUIRE)) {
+		drain_rings(tester);
+		usleep(TRACE_DRAIN_US);
+	}
+	drain_rings(tester);
+
+	return 0;
+}
+
+void trace_open(struct test *tester, char *filename)
+{
+	int i;
+	char *c;
+
+	trace_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (trace_fd == -1)
+		fatal_error("Failed to open the trace file.");
+
+	trace_last = malloc(sizeof(struct trace_last) * tester->num_tasks);
+	if (!trace_last)
+		fatal_error("Failed to allocate memory.");
+
+	for (c = TRACE_MAGIC; *c; c++)
+		put_byte(*c);
+	put_varint(TRACE_VERSION);
+	put_varint(tester->num_tasks);
+	for (i = tester->num_tasks - 1; i >= 0; i--)
+		put_varint(tester->tasks[i]->period);
+
+	for (i = 0; i < tester->num_tasks; i++) {
+		tester->tasks[i]->trace =
+		    (struct trace_ring *)salloc(sizeof(struct trace_ring));
+		if (!tester->tasks[i]->trace)
+			fatal_error("Failed to allocate memory.");
+	}
+}
+
+void trace_close(struct test *tester)
+{
+	int i;
+
+	for (i = 0; i < tester->num_tasks; i++) {
+		sfree(tester->tasks[i]->trace);
+		tester->tasks[i]->trace = 0;
+	}
+	free(trace_last);
+	trace_last = 0;
+	flush_trace();
+	if (close(trace_fd) || trace_failed)
+		warning("Failed to write the trace file.");
+	trace_fd = -1;
+}
+
+void trace_begin_run(struct test *tester)
+{
+	struct trace_event run = {.type = TRACE_RUN };
+	struct timespec now;
+	struct sched_param param = {.sched_priority = 0 };
+	pthread_attr_t attr;
+	int i;
+
+	//no task is running, so the rings can be emptied from here
+	for (i = 0; i < tester->num_tasks; i++) {
+		tester->tasks[i]->trace->head = 0;
+		tester->tasks[i]->trace->tail = 0;
+		tester->tasks[i]->trace->dropped = 0;
+	}
+	memset(trace_last, 0, sizeof(struct trace_last) * tester->num_tasks);
+
+	chronos_clock_gettime(chronos_deadline_clock(), &now);
+	run.time = (unsigned long long)now.tv_sec * BILLION + now.tv_nsec;
+	run.tsc = read_tsc();
+	run.arg = tester->options->cpu_usage;
+	write_event(&run, 0);
+	trace_written = 0;
+
+	//drain at normal priority, so that the tasks always come first
+	drain_stop = 0;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	if (pthread_create(&drain_thread, &attr, drain_main, tester))
+		fatal_error("Failed to create the trace drain thread.");
+	pthread_attr_destroy(&attr);
+}
+
+void trace_end_run(struct test *tester, unsigned long *written,
+		   unsigned long *dropped)
+{
+	int i;
+
+	__atomic_store_n(&drain_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(drain_thread, 0);
+	flush_trace();
+
+	*written = trace_written;
+	*dropped = 0;
+	for (i = 0; i < tester->num_tasks; i++)
+		*dropped += tester->tasks[i]->trace->dropped;
+}
+
+/*
+ * Read a varint, returning -1 at the end of the file.
+ */
+static int get_varint(FILE * f, unsigned long long *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		if ((c = getc(f)) == EOF || shift > 63)
+			return -1;
+		*v |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+static int get_delta(FILE * f, unsigned long long *v)
+{
+	unsigned long long z;
+
+	if (get_varint(f, &z))
+		return -1;
+	*v += (z >> 1) ^ -(z & 1);
+	return 0;
+}
+
+/*
+ * What export_trace knows of the job each task is running.
+ */
+struct export_task {
+	unsigned long long period;	//nanoseconds
+	unsigned long long release;
+	unsigned long long begin;
+	unsigned long long begin_tsc;
+	int begun;		//false until the job's TRACE_BEGIN is seen
+	unsigned int counted;	//the counters the job has a TRACE_COUNTER for
+	unsigned long long counts[PERF_COUNTERS];
+	int num_held;
+	unsigned short held[TRACE_MAX_HELD];
+	unsigned long long held_since[TRACE_MAX_HELD];
+};
+
+/*
+ * Chrome trace timestamps are microseconds, from the start of the first run.
+ */
+static double export_us(unsigned long long time, unsigned long long origin)
+{
+	return (double)(long long)(time - origin) / THOUSAND;
+}
+
+int export_trace(char *filename)
+{
+	char magic[sizeof(TRACE_MAGIC) - 1];
+	unsigned long long version, num_tasks, period, origin = 0;
+	struct export_task *tasks;
+	struct trace_last *last;
+	char *sep = "";
+	int c, run = 0, i, k;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		printf("Error: Failed to open the trace file.\n");
+		return 1;
+	}
+
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+	    memcmp(magic, TRACE_MAGIC, sizeof(magic)) ||
+	    get_varint(f, &version) || version != TRACE_VERSION ||
+	    get_varint(f, &num_tasks)) {
+		printf("Error: Not a trace file sched_test_app can read.\n");
+		fclose(f);
+		return 1;
+	}
+
+	tasks = calloc(num_tasks, sizeof(struct export_task));
+	last = calloc(num_tasks, sizeof(struct trace_last));
+	if (!tasks || !last)
+		fatal_error("Failed to allocate memory.");
+	for (i = 0; i < num_tasks; i++) {
+		if (get_varint(f, &period))
+			break;
+		tasks[i].period = period * THOUSAND;
+	}
+	if (i < num_tasks) {
+		printf("Error: The trace file is truncated.\n");
+		free(tasks);
+		free(last);
+		fclose(f);
+		return 1;
+	}
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	while ((c = getc(f)) != EOF) {
+		unsigned long long task, job, time, tsc, arg;
+		struct export_task *et;
+
+		if (get_varint(f, &task) || task >= num_tasks)
+			break;
+		if (c == TRACE_RUN)
+			memset(last, 0, sizeof(struct trace_last) * num_tasks);
+		job = last[task].job;
+		time = last[task].time;
+		tsc = last[task].tsc;
+		if (get_delta(f, &job) || get_delta(f, &time) ||
+		    (c == TRACE_COUNTER ? get_varint(f, &tsc) :
+		     get_delta(f, &tsc)) || get_varint(f, &arg))
+			break;
+		last[task].job = job;
+		last[task].time = time;
+		if (c != TRACE_COUNTER)
+			last[task].tsc = tsc;
+		et = &tasks[task];
+
+		switch (c) {
+		case TRACE_RUN:
+			//each run is a process, with a thread for each task
+			if (!run)
+				origin = time;
+			run++;
+			printf("%s\n{\"ph\":\"M\",\"name\":\"process_name\","
+			       "\"pid\":%d,\"args\":{\"name\":"
+			       "\"Run %d (usage %llu%%)\"}}", sep, run, run, arg);
+			sep = ",";
+			for (k = 0; k < num_tasks; k++) {
+				printf(",\n{\"ph\":\"M\",\"name\":\"thread_name\","
+				       "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":"
+				       "\"Task %d\"}}", run, k, k);
+				tasks[k].begun = 0;
+				tasks[k].num_held = 0;
+			}
+			break;
+
+		case TRACE_RELEASE:
+			et->release = time;
+			if (run)
+				printf(",\n{\"ph\":\"i\",\"s\":\"t\",\"name\":"
+				       "\"release\",\"pid\":%d,\"tid\":%llu,"
+				       "\"ts\":%.3f}", run, task,
+				       export_us(time, origin));
+			break;
+
+		case TRACE_BEGIN:
+			et->begin = time;
+			et->begin_tsc = tsc;
+			et->begun = 1;
+			et->num_held = 0;
+			et->counted = 0;
+			break;
+
+		case TRACE_COUNTER:
+			if (arg < PERF_COUNTERS) {
+				et->counts[arg] = tsc;
+				et->counted |= 1 << arg;
+			}
+			break;
+
+		case TRACE_LOCK:
+			if (et->num_held < TRACE_MAX_HELD) {
+				et->held[et->num_held] = arg;
+				et->held_since[et->num_held++] = time;
+			}
+			break;
+
+		case TRACE_UNLOCK:
+			for (k = et->num_held - 1; k >= 0; k--)
+				if (et->held[k] == arg)
+					break;
+			if (k < 0 || !run)
+				break;
+			printf(",\n{\"ph\":\"X\",\"name\":\"lock %llu\","
+			       "\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,"
+			       "\"dur\":%.3f}", arg, run, task,
+			       export_us(et->held_since[k], origin),
+			       export_us(time, et->held_since[k]));
+			et->held[k] = et->held[--et->num_held];
+			et->held_since[k] = et->held_since[et->num_held];
+			break;
+
+		case TRACE_END:
+			if (!et->begun || !run)
+				break;
+			printf(",\n{\"ph\":\"X\",\"name\":\"job %llu\","
+			       "\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,"
+			       "\"dur\":%.3f,\"args\":{\"release\":%.3f,"
+			       "\"deadline\":%.3f,\"response\":%.3f,"
+			       "\"tsc\":%llu,\"aborted\":%d,\"counted\":%d,"
+			       "\"met\":%d", job, run, task,
+			       export_us(et->begin, origin),
+			       export_us(time, et->begin),
+			       export_us(et->release, origin),
+			       export_us(et->release + et->period, origin),
+			       export_us(time, et->release),
+			       tsc - et->begin_tsc,
+			       !!(arg & TRACE_END_ABORTED),
+			       !!(arg & TRACE_END_COUNTED),
+			       !!(arg & TRACE_END_MET));
+			for (k = 0; k < PERF_COUNTERS; k++)
+				if (et->counted & 1 << k)
+					printf(",\"%s\":%llu",
+					       perf_counter_names[k],
+					       et->counts[k]);
+			printf("}}");
+			et->begun = 0;
+			break;
+		}
+	}
+
+	printf("\n]}\n");
+
+	free(tasks);
+	free(last);
+	fclose(f);
+	return 0;
+}
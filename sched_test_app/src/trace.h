@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2009-2012 Virginia Tech Real-Time Systems Lab           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "tester_types.h"
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * The events of a job which go in the trace. Every event carries the time (on
+ * chronos_deadline_clock) and the TSC it happened at, the task and the job;
+ * arg is the lock for TRACE_LOCK and TRACE_UNLOCK, the TRACE_END_* flags for
+ * TRACE_END and the usage for TRACE_RUN, which starts each run of a batch.
+ * A TRACE_COUNTER event gives what one of the performance counters (arg)
+ * counted over the job in place of the TSC, just before its TRACE_END.
+ */
+#define TRACE_RUN	0
+#define TRACE_RELEASE	1	//the instant the job was due to be released at
+#define TRACE_BEGIN	2	//when it actually started running
+#define TRACE_LOCK	3	//when it acquired a lock
+#define TRACE_UNLOCK	4	//when it released it
+#define TRACE_END	5	//when it finished (or gave up, if it was aborted)
+#define TRACE_COUNTER	6
+
+#define TRACE_END_ABORTED	1
+#define TRACE_END_COUNTED	2	//the job is part of the statistics
+#define TRACE_END_MET		4	//it finished by its deadline
+
+struct trace_event {
+	unsigned long long time;	//nanoseconds
+	union {
+		unsigned long long tsc;
+		unsigned long long count;	//for TRACE_COUNTER
+	};
+	unsigned int job;
+	unsigned short type;
+	unsigned short arg;
+};
+
+/*
+ * Each task writes its events into a ring of its own in shared memory, which
+ * the main process empties into the trace file while the run goes on. The task
+ * is the only writer of head and the drain thread the only writer of tail, so
+ * neither ever waits for the other: a task which finds its ring full counts
+ * the event as dropped instead.
+ */
+#define TRACE_RING_EVENTS	2048	//a power of two
+
+struct trace_ring {
+	unsigned long head;	//events written by the task
+	unsigned long dropped;	//events the task found no room for
+	char pad[64 - 2 * sizeof(unsigned long)];	//keep tail on a cache line of its own
+	unsigned long tail;	//events read by the drain thread
+	struct trace_event events[TRACE_RING_EVENTS];
+};
+
+/*
+ * Create the trace file @filename and give every task of @tester a ring.
+ * Must be called after the taskset is read and before anything forks.
+ */
+void trace_open(struct test *tester, char *filename);
+void trace_close(struct test *tester);
+
+/*
+ * Mark the start of a run in the trace and start the thread which drains the
+ * rings into it; trace_end_run stops it once the tasks are done, and returns
+ * the events written and dropped over the run.
+ */
+void trace_begin_run(struct test *tester);
+void trace_end_run(struct test *tester, unsigned long *written,
+		   unsigned long *dropped);
+
+/*
+ * Record an event of @t's current job, which happened @when (or now, if null).
+ */
+void trace_event(struct task *t, int type, int arg, struct timespec *when);
+
+/*
+ * Record what each of the performance counters which are @available counted
+ * over @t's current job, which ended @when.
+ */
+void trace_counters(struct task *t, unsigned int available,
+		    unsigned long long *counts, struct timespec *when);
+
+/*
+ * Convert the trace file @filename to the Chrome trace event JSON format, which
+ * Perfetto reads, on stdout. Returns nonzero if the file can't be read.
+ */
+int export_trace(char *filename);
+
+#endif				/* TRACE_H */
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 
 #ifndef UTILS_H
 #define UTILS_H
@@ -59,6 +60,18 @@ static inline void warning(char msg[])
 #define TASK_CLEANUP_PRIO               92
 #define TASK_RUN_PRIO                   90
 
+/* Time compression is refused once the per-job overhead exceeds this percent
+ * of the shortest job, measured over that many empty jobs */
+#define MAX_COMPRESSION_OVERHEAD        1
+#define OVERHEAD_JOBS                   1000
+
+/* Stack size of the task threads, in KiB */
+#define DEFAULT_STACK_KB                256
+
+/* How far ahead of the tasks arriving the start time of a run is set */
+#define START_DELAY_US                  10000
+#define START_DELAY_PER_TASK_US         500
+
 /* Numerical definitions */
 #define THOUSAND   1000
 #define MILLION    1000000
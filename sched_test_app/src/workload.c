@@ -20,9 +20,48 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <setjmp.h>
+#include <signal.h>
+
 #include "workload.h"
 #include "task.h"
 
+/*
+ * In CHRONOS_ABORT_SIGNAL mode, the workload runs without polling the abort
+ * byte and the abort signal unwinds it instead. The handler only jumps while
+ * the thread is inside the workload; a signal arriving anywhere else is left
+ * to the abort byte checks around it.
+ */
+static __thread sigjmp_buf abort_jmp;
+static __thread volatile sig_atomic_t abort_armed = 0;
+
+static void abort_signal_handler(int sig)
+{
+	if (!abort_armed)
+		return;
+	abort_armed = 0;
+	siglongjmp(abort_jmp, 1);
+}
+
+/*
+ * Install the abort signal handler, if aborts are delivered by signal. This
+ * must happen before the thread groups are forked so they inherit it.
+ */
+void workload_init_aborts(struct test *tester)
+{
+	struct sigaction sa;
+
+	if (get_abort_notify() != CHRONOS_ABORT_SIGNAL)
+		return;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = abort_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(CHRONOS_ABORT_SIGNO, &sa, NULL))
+		fatal_error("Failed to install the abort signal handler.");
+}
+
 /*
  * Initialize any global memory, structs, or variables needed for this workload.
  */
@@ -74,6 +113,10 @@ void workload_init_task(struct task *t)
 		t->workload_data =
 		    w->init_task(t->group_leader->workload_tg_data, task_wss);
 
+	//simulated tasks never actually execute the workload
+	if (t->tester->options->backend == CHRONOS_BACKEND_SIM)
+		return;
+
 	switch (t->tester->options->timing_method) {
 	case TIMING_AVERAGE:
 	case TIMING_TIMER:
@@ -161,6 +204,20 @@ static int do_work_slope(struct task *t, unsigned long usage, double exec_slope)
 	unsigned long iters_per_abort_check = exec_slope * ABORT_CHECK_US;
 	unsigned long i;
 
+	//with signal delivery, run every iteration in one go until the signal unwinds us
+	if (get_abort_notify() == CHRONOS_ABORT_SIGNAL) {
+		if (!sigsetjmp(abort_jmp, 1)) {
+			abort_armed = 1;
+			if (!*t->abort_pointer)
+				t->tester->workload->do_work(t->group_leader->
+							     workload_tg_data,
+							     t->workload_data,
+							     iterations);
+		}
+		abort_armed = 0;
+		return (*t->abort_pointer) != 0;
+	}
+
 	for (i = 0;
 	     !(*t->abort_pointer) && (i + iters_per_abort_check < iterations);
 	     i += iters_per_abort_check)
@@ -235,11 +292,17 @@ static int do_work_timer(struct task *t, unsigned long usage)
 {
 	int last_iters;
 	double diff = 0, end_time, now, last = 0;
+	int signals = get_abort_notify() == CHRONOS_ABORT_SIGNAL;
 
 	//get average slope, and calculate the number of iterations per abort check based on that
 	double exec_slope = t->cached_slope;
 	unsigned long iters_per_abort_check = exec_slope * ABORT_CHECK_US;
 
+	//the timer still needs checking between chunks, but the signal stops us mid-chunk
+	if (signals && sigsetjmp(abort_jmp, 1))
+		goto out;
+	abort_armed = signals;
+
 	now = get_thread_cputime();
 	end_time =
 	    now +
@@ -271,6 +334,7 @@ static int do_work_timer(struct task *t, unsigned long usage)
 					     t->workload_data, last_iters);
 
  out:
+	abort_armed = 0;
 	return (*t->abort_pointer) != 0;	//return non-zero if this task has been aborted
 }
 
@@ -285,6 +349,10 @@ int workload_do_work(struct task *t, unsigned long usage)
 	assert(t && t->tester && t->tester->workload
 	       && t->tester->workload->do_work);
 
+	//in a simulation, the backend accounts for the time in virtual time
+	if (t->tester->options->backend == CHRONOS_BACKEND_SIM)
+		return chronos_sim_consume(usage) != 0;
+
 	//see which timing control method we're using and call the do_work function specific to that timing method
 	if (t->tester->options->timing_method == TIMING_AVERAGE)
 		return do_work_average(t, usage);
@@ -43,6 +43,7 @@
  * workload-specific functions in an instance of the above struct workload.
  */
 void workload_init_global(struct test *tester);
+void workload_init_aborts(struct test *tester);
 void workload_init_group(struct task *t);
 void workload_init_task(struct task *t);
 void workload_cleanup_global(struct test *tester);